@@ -0,0 +1,386 @@
+// Benchmarks nconio over a pseudo-terminal.
+//
+// Every scenario runs in a child process on the slave side of a forkpty while
+// this process drains the master side, like a terminal emulator would. One
+// line of JSON is printed per scenario, so results can be compared between
+// commits.
+//
+// Build with the VT backend (reports bytes and write calls per frame):
+//     gcc -O2 -DNCONIO_VT -o bench examples/bench.c -lutil
+// or with ncurses (only what the pty receives is measured):
+//     gcc -O2 -o bench examples/bench.c -lncursesw -lutil
+//
+// Usage: bench [frames] [cols] [rows]
+
+#define _DEFAULT_SOURCE
+#define NCONIO_IMPL
+#include "../nconio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+#ifdef NCONIO_VT
+#define BACKEND "vt"
+#else
+#define BACKEND "ncurses"
+#endif
+
+#define LATENCY_SAMPLES 200
+
+static long long now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Fixed seed, every run draws the same frames
+static unsigned int rng_state = 12345;
+
+static unsigned int rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+//
+// Scenarios, run in the child on the slave side of the pty
+//
+
+// Every cell gets a random character and one of the 16 colors
+static void frame_full(int frame, int w, int h)
+{
+    (void)frame;
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            textcolor((int)(rng() % 16));
+            putchat((char)('!' + rng() % 94), x, y);
+        }
+    }
+}
+
+// The rogue2 pattern: a static map with a few sprites moving over it
+#define SPRITES 16
+static int sprite_x[SPRITES], sprite_y[SPRITES];
+
+static char map_at(int x, int y)
+{
+    return (x % 8 == 0 || y % 6 == 0) ? '#' : '.';
+}
+
+static void frame_sprites(int frame, int w, int h)
+{
+    if (frame == 0)
+    {
+        char *row = (char *)malloc((size_t)w);
+        for (int y = 0; y < h; y++)
+        {
+            for (int x = 0; x < w; x++)
+            {
+                row[x] = map_at(x, y);
+            }
+            putrow(row, NULL, w, 0, y);
+        }
+        free(row);
+        for (int i = 0; i < SPRITES; i++)
+        {
+            sprite_x[i] = (int)(rng() % (unsigned int)w);
+            sprite_y[i] = (int)(rng() % (unsigned int)h);
+        }
+    }
+
+    for (int i = 0; i < SPRITES; i++)
+    {
+        putchat(map_at(sprite_x[i], sprite_y[i]), sprite_x[i], sprite_y[i]);
+        sprite_x[i] = (sprite_x[i] + (int)(rng() % 3) - 1 + w) % w;
+        sprite_y[i] = (sprite_y[i] + (int)(rng() % 3) - 1 + h) % h;
+        putchat((char)('A' + i), sprite_x[i], sprite_y[i]);
+    }
+}
+
+// A log that scrolls up by one line every frame
+static void frame_scroll(int frame, int w, int h)
+{
+    char line[512];
+    int len = w < (int)sizeof(line) ? w : (int)sizeof(line);
+
+    for (int y = 0; y < h; y++)
+    {
+        int n = snprintf(line, sizeof(line), "%6d: log line with some text in it", frame + y);
+        memset(line + n, ' ', sizeof(line) - (size_t)n);
+        putrow(line, NULL, len, 0, y);
+    }
+}
+
+// Every cell with its own 256-color foreground and background
+static void frame_colors(int frame, int w, int h)
+{
+    (void)frame;
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            nconio_setstyle(nconio_makestyle(NCONIO_COLOR256(rng() % 256), NCONIO_COLOR256(rng() % 256), 0));
+            putchat((char)('a' + rng() % 26), x, y);
+        }
+    }
+}
+
+// A camera panning over a tilemap four times the size of the screen, right
+// every frame and down every third
+static nconio_tilemap *pan_map = NULL;
+
+static void frame_pan(int frame, int w, int h)
+{
+    if (frame == 0)
+    {
+        pan_map = nconio_newtilemap();
+        nconio_deftile(pan_map, '#', '#', nconio_makestyle(NCONIO_DARKGRAY, NCONIO_BLACK, 0));
+        nconio_deftile(pan_map, '~', '~', nconio_makestyle(NCONIO_BLUE, NCONIO_BLACK, 0));
+        for (int y = 0; y < 4 * h; y++)
+        {
+            for (int x = 0; x < 4 * w; x++)
+            {
+                unsigned int r = rng() % 16;
+                nconio_settile(pan_map, x, y, map_at(x, y) == '#' ? '#' : r == 0 ? '~' : r == 1 ? ',' : '.');
+            }
+        }
+    }
+    nconio_drawtilemap(pan_map, frame % (3 * w), frame / 3 % (3 * h), 0, 0, w, h);
+}
+
+typedef struct
+{
+    const char *name;
+    void (*frame)(int frame, int w, int h);
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    {"full", frame_full},
+    {"sprites", frame_sprites},
+    {"scroll", frame_scroll},
+    {"colors", frame_colors},
+    {"pan", frame_pan},
+};
+
+// Draw the frames and report "frames elapsed_us bytes writes" on resultfd
+static void child_frames(const scenario_t *scenario, int frames, int resultfd)
+{
+    nconio_stats total;
+    long long start;
+
+    nconioinit();
+    hidecursor();
+    nconio_flush();
+    nconio_resetstats();
+
+    start = now_us();
+    for (int f = 0; f < frames; f++)
+    {
+        nconio_beginframe();
+        scenario->frame(f, conw(), conh());
+        nconio_endframe();
+    }
+    long long elapsed = now_us() - start;
+    nconio_getstats(NULL, &total);
+    nconiocleanup();
+
+    dprintf(resultfd, "%d %lld %lu %lu\n", frames, elapsed, total.bytes, total.writes);
+}
+
+// Answer every key with a redraw, until LATENCY_SAMPLES keys came in
+static void child_latency(void)
+{
+    char text[32];
+
+    nconioinit();
+    for (int i = 0; i < LATENCY_SAMPLES; i++)
+    {
+        getchr();
+        snprintf(text, sizeof(text), "key %d", i);
+        putstrat(text, 0, 0); // Flushed right away
+    }
+    nconiocleanup();
+}
+
+//
+// Parent, on the master side of the pty
+//
+
+static long drain(int fd, int timeout_ms)
+{
+    char buf[65536];
+    long total = 0;
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    while (poll(&pfd, 1, timeout_ms) > 0)
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+        {
+            return total > 0 ? total : -1; // EIO once the child closed the slave side
+        }
+        total += n;
+    }
+    return total;
+}
+
+static pid_t spawn(int cols, int rows, int *master)
+{
+    struct winsize ws;
+    memset(&ws, 0, sizeof(ws));
+    ws.ws_col = (unsigned short)cols;
+    ws.ws_row = (unsigned short)rows;
+    return forkpty(master, NULL, NULL, &ws);
+}
+
+static void run_frames(const scenario_t *scenario, int frames, int cols, int rows)
+{
+    int result[2], master;
+    long ptybytes = 0;
+    char line[256] = "";
+
+    if (pipe(result) != 0)
+    {
+        return;
+    }
+    setenv("TERM", "xterm-256color", 1);
+    pid_t pid = spawn(cols, rows, &master);
+    if (pid < 0)
+    {
+        perror("forkpty");
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        close(result[0]);
+        child_frames(scenario, frames, result[1]);
+        _exit(0);
+    }
+    close(result[1]);
+
+    for (;;)
+    {
+        long n = drain(master, 1000);
+        if (n <= 0)
+        {
+            break;
+        }
+        ptybytes += n;
+    }
+    waitpid(pid, NULL, 0);
+    close(master);
+
+    ssize_t len = read(result[0], line, sizeof(line) - 1);
+    close(result[0]);
+    line[len > 0 ? len : 0] = '\0';
+
+    int nframes = 0;
+    long long elapsed = 0;
+    unsigned long bytes = 0, writes = 0;
+    if (sscanf(line, "%d %lld %lu %lu", &nframes, &elapsed, &bytes, &writes) != 4 || nframes == 0)
+    {
+        fprintf(stderr, "%s: no result from the child\n", scenario->name);
+        return;
+    }
+
+    printf("{\"scenario\":\"%s\",\"backend\":\"%s\",\"cols\":%d,\"rows\":%d,\"frames\":%d,"
+           "\"fps\":%.1f,\"bytes_per_frame\":%.1f,\"writes_per_frame\":%.2f,\"pty_bytes_per_frame\":%.1f}\n",
+           scenario->name, BACKEND, cols, rows, nframes,
+           elapsed > 0 ? nframes * 1e6 / (double)elapsed : 0.0,
+           (double)bytes / nframes, (double)writes / nframes, (double)ptybytes / nframes);
+    fflush(stdout);
+}
+
+static int compare_ll(const void *a, const void *b)
+{
+    long long da = *(const long long *)a, db = *(const long long *)b;
+    return da < db ? -1 : da > db;
+}
+
+// Time from writing a key into the pty until the redraw it causes comes out
+static void run_latency(int cols, int rows)
+{
+    long long samples[LATENCY_SAMPLES], sum = 0;
+    int master, count = 0;
+
+    setenv("TERM", "xterm-256color", 1);
+    pid_t pid = spawn(cols, rows, &master);
+    if (pid < 0)
+    {
+        perror("forkpty");
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        child_latency();
+        _exit(0);
+    }
+
+    drain(master, 200); // Output of nconioinit
+    for (int i = 0; i < LATENCY_SAMPLES; i++)
+    {
+        struct pollfd pfd = {master, POLLIN, 0};
+        long long start = now_us();
+        if (write(master, "x", 1) != 1 || poll(&pfd, 1, 1000) <= 0)
+        {
+            break;
+        }
+        samples[count++] = now_us() - start;
+        drain(master, 1); // The rest of the redraw
+    }
+    drain(master, 200);
+    waitpid(pid, NULL, 0);
+    close(master);
+
+    if (count == 0)
+    {
+        fprintf(stderr, "latency: no redraw came back\n");
+        return;
+    }
+    qsort(samples, (size_t)count, sizeof(long long), compare_ll);
+    for (int i = 0; i < count; i++)
+    {
+        sum += samples[i];
+    }
+    printf("{\"scenario\":\"latency\",\"backend\":\"%s\",\"cols\":%d,\"rows\":%d,\"samples\":%d,"
+           "\"avg_us\":%.1f,\"p50_us\":%lld,\"p99_us\":%lld}\n",
+           BACKEND, cols, rows, count, (double)sum / count, samples[count / 2], samples[(count * 99 - 1) / 100]);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 300;
+    int cols = argc > 2 ? atoi(argv[2]) : 120;
+    int rows = argc > 3 ? atoi(argv[3]) : 40;
+
+    if (frames <= 0 || cols <= 0 || rows <= 0)
+    {
+        fprintf(stderr, "usage: %s [frames] [cols] [rows]\n", argv[0]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+    {
+        run_frames(&scenarios[i], frames, cols, rows);
+    }
+    run_latency(cols, rows);
+    return 0;
+}
@@ -0,0 +1,178 @@
+// Micro-benchmark of the screen diff.
+//
+// Times the kernels that find the changed spans between the back and the
+// front buffer (scalar, SSE2, AVX2 where the CPU has it) on frames where
+// nothing, a few sprites, every other cell or every cell changed. One line of
+// JSON is printed per kernel and frame, with the cells scanned per nanosecond.
+//
+// Build (no terminal or ncurses needed):
+//     gcc -O2 -DNCONIO_VT -o diffbench examples/diffbench.c
+//
+// Usage: diffbench [frames] [cols] [rows]
+
+#define _DEFAULT_SOURCE
+#define NCONIO_IMPL
+#include "../nconio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+typedef int (*skipcells_t)(const __nconio_cell *back, const __nconio_cell *front, int x, int end, int equal);
+
+typedef struct
+{
+    const char *name;
+    skipcells_t skip;
+} kernel_t;
+
+static kernel_t kernels[3];
+static int kernelcount = 0;
+static volatile long sink; // Keeps the timed diffs from being optimized away
+
+// How the back buffer differs from the front buffer
+typedef struct
+{
+    const char *name;
+    int every; // Every n-th cell changed, 0 for the sprites pattern
+} change_t;
+
+static const change_t changes[] = {
+    {"clean", -1},
+    {"sparse", 0},
+    {"alternate", 2},
+    {"full", 1},
+};
+
+static int changed(const change_t *change, int x, int y, int w)
+{
+    if (change->every < 0)
+    {
+        return 0;
+    }
+    if (change->every == 0)
+    {
+        return (y * w + x) % 997 < 3; // A few short spans scattered over the screen
+    }
+    return x % change->every == 0;
+}
+
+// Fill both buffers, the back buffer with the changes
+static void setup(__nconio_cell *back, __nconio_cell *front, const change_t *change, int w, int h)
+{
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            __nconio_cell *b = &back[y * w + x], *f = &front[y * w + x];
+            f->ch = (unsigned short)('a' + (x + y) % 26);
+            f->style = (unsigned short)(x / 10 % 4);
+            b->ch = f->ch;
+            b->style = f->style;
+            if (changed(change, x, y, w))
+            {
+                if ((x + y) % 2)
+                {
+                    b->ch = '#';
+                }
+                else
+                {
+                    b->style++;
+                }
+            }
+        }
+    }
+}
+
+// What a present does: every row scanned for spans. Returns the changed cells.
+static long diff(skipcells_t skip, const __nconio_cell *back, const __nconio_cell *front, int w, int h)
+{
+    long cells = 0;
+
+    for (int y = 0; y < h; y++)
+    {
+        const __nconio_cell *b = back + (size_t)y * w, *f = front + (size_t)y * w;
+        int x = 0;
+        while ((x = skip(b, f, x, w, 1)) < w)
+        {
+            int end = skip(b, f, x + 1, w, 0);
+            cells += end - x;
+            x = end;
+        }
+    }
+    return cells;
+}
+
+int main(int argc, char **argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 2000;
+    int cols = argc > 2 ? atoi(argv[2]) : 300;
+    int rows = argc > 3 ? atoi(argv[3]) : 100;
+
+    if (frames <= 0 || cols <= 0 || rows <= 0)
+    {
+        fprintf(stderr, "usage: %s [frames] [cols] [rows]\n", argv[0]);
+        return 1;
+    }
+
+    kernels[kernelcount++] = (kernel_t){"scalar", __nconio_skipcells_scalar};
+#ifdef __NCONIO_SSE2
+    kernels[kernelcount++] = (kernel_t){"sse2", __nconio_skipcells_sse2};
+#endif
+#ifdef __NCONIO_AVX2
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernels[kernelcount++] = (kernel_t){"avx2", __nconio_skipcells_avx2};
+    }
+#endif
+
+    __nconio_cell *back = (__nconio_cell *)malloc((size_t)cols * rows * sizeof(__nconio_cell));
+    __nconio_cell *front = (__nconio_cell *)malloc((size_t)cols * rows * sizeof(__nconio_cell));
+    if (back == NULL || front == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (size_t c = 0; c < sizeof(changes) / sizeof(changes[0]); c++)
+    {
+        long expected = -1;
+
+        setup(back, front, &changes[c], cols, rows);
+        for (int k = 0; k < kernelcount; k++)
+        {
+            long cells = diff(kernels[k].skip, back, front, cols, rows); // Warm up
+            if (expected >= 0 && cells != expected)
+            {
+                fprintf(stderr, "%s: %s found %ld changed cells, scalar %ld\n", changes[c].name, kernels[k].name, cells, expected);
+                return 1;
+            }
+            expected = cells;
+
+            long long start = now_ns();
+            for (int f = 0; f < frames; f++)
+            {
+                cells += diff(kernels[k].skip, back, front, cols, rows);
+            }
+            long long elapsed = now_ns() - start;
+            sink = cells;
+
+            printf("{\"frame\":\"%s\",\"kernel\":\"%s\",\"cols\":%d,\"rows\":%d,\"changed\":%ld,"
+                   "\"ns_per_frame\":%.1f,\"cells_per_ns\":%.2f}\n",
+                   changes[c].name, kernels[k].name, cols, rows, expected,
+                   (double)elapsed / frames, elapsed > 0 ? (double)cols * rows * frames / elapsed : 0.0);
+            fflush(stdout);
+        }
+    }
+
+    free(back);
+    free(front);
+    return 0;
+}
@@ -12,61 +12,43 @@
 // MAP
 //
 
-char **map_new(int numrows, int numcols)
-{
-    char **map = malloc(numrows * sizeof(char *));
+#define MAP_W 240 // Far larger than the screen, the camera follows the player
+#define MAP_H 96
 
-    for (int i = 0; i < numrows; i++)
-    {
-        map[i] = malloc(numcols * sizeof(char));
-        if (map[i] == NULL)
-        {
-            for (int j = 0; j < i; j++)
-            {
-                free(map[j]);
-            }
-            free(map);
-            return NULL;
-        }
-    }
+// Rooms of 30 x 16 tiles with a door in the middle of every wall
+nconio_tilemap *map_new(void)
+{
+    nconio_tilemap *map = nconio_newtilemap();
 
-    for (int y = 0; y < numrows; y++)
+    if (map == NULL)
     {
-        for (int x = 0; x < numcols; x++)
-        {
-            map[y][x] = '#';
-        }
+        return NULL;
     }
+    nconio_deftile(map, '#', '#', nconio_makestyle(NCONIO_DARKGRAY, NCONIO_BLACK, 0));
 
-    for (int y = 11; y < numrows / 2; y++)
+    for (int y = 0; y < MAP_H; y++)
     {
-        for (int x = 11; x < numcols / 2; x++)
+        for (int x = 0; x < MAP_W; x++)
         {
-            map[y][x] = ' ';
+            int wall = x % 30 == 0 || y % 16 == 0 || x == MAP_W - 1 || y == MAP_H - 1;
+            int door = (x % 30 == 15 || y % 16 == 8) && x > 0 && y > 0 && x < MAP_W - 1 && y < MAP_H - 1;
+            nconio_settile(map, x, y, wall && !door ? '#' : ' ');
         }
     }
 
     return map;
 }
 
-void map_free(char **map, int numrows)
+// Top left corner of the view, centered on x, y but kept on the map
+int camera_at(int x, int size, int mapsize)
 {
-    for (int i = 0; i < numrows; i++)
-    {
-        free(map[i]);
-    }
-    free(map);
-}
+    int cam = x - size / 2;
 
-void map_print(char **map, int numrows, int numcols)
-{
-    for (int y = 0; y < numrows; y++)
+    if (cam > mapsize - size)
     {
-        for (int x = 0; x < numcols; x++)
-        {
-            putchat(map[y][x], x, y);
-        }
+        cam = mapsize - size;
     }
+    return cam < 0 ? 0 : cam;
 }
 
 //
@@ -77,11 +59,7 @@ typedef struct
 {
     int x;
     int y;
-    int prevx;
-    int prevy;
-    char ch;
-    char prevch;
-    char nextch;
+    nconio_surface *sprite; // Drawn over the map, which stays untouched below
 } player_t;
 
 player_t *player_new(int x, int y)
@@ -90,98 +68,89 @@ player_t *player_new(int x, int y)
 
     player->x = x;
     player->y = y;
-    player->prevx = player->x;
-    player->prevy = player->y;
-    player->ch = '@';
 
-    player->prevch = getchat(player->x, player->y);
-    player->nextch = player->prevch;
+    player->sprite = nconio_newsurface(1, 1, 1);
+    nconio_settarget(player->sprite);
+    putchat('@', 0, 0);
+    nconio_settarget(NULL);
 
     return player;
 }
 
-void player_move(player_t *player, char **map, int input, int numrows, int numcols)
+void player_free(player_t *player)
+{
+    nconio_freesurface(player->sprite);
+    free(player);
+}
+
+void player_move(player_t *player, const nconio_tilemap *map, int input)
 {
-    player->prevx = player->x;
-    player->prevy = player->y;
+    int x = player->x, y = player->y;
 
-    // Handle input and update player position, ensuring it stays within bounds
-    if ((input == 0x26 || input == 0x57) && player->y > 0) // arrow up || w
+    // Handle input, the player only walks on floor (outside the map every tile is 0)
+    if (input == 0x26 || input == 0x57) // arrow up || w
     {
-        if (map[player->y - 1][player->x] == ' ')
-        {
-            player->y--;
-            player->nextch = getchat(player->x, player->y);
-        }
+        y--;
     }
-    else if ((input == 0x28 || input == 0x53) && player->y < numrows - 1) // arrow down || s
+    else if (input == 0x28 || input == 0x53) // arrow down || s
     {
-        if (map[player->y + 1][player->x] == ' ')
-        {
-            player->y++;
-            player->nextch = getchat(player->x, player->y);
-        }
+        y++;
     }
-    else if ((input == 0x25 || input == 0x41) && player->x > 0) // arrow left || a
+    else if (input == 0x25 || input == 0x41) // arrow left || a
     {
-        if (map[player->y][player->x - 1] == ' ')
-        {
-            player->x--;
-            player->nextch = getchat(player->x, player->y);
-        }
+        x--;
     }
-    else if ((input == 0x27 || input == 0x44) && player->x < numcols - 1) // arrow right || d
+    else if (input == 0x27 || input == 0x44) // arrow right || d
     {
-        if (map[player->y][player->x + 1] == ' ')
-        {
-            player->x++;
-            player->nextch = getchat(player->x, player->y);
-        }
+        x++;
+    }
+
+    if (nconio_gettile(map, x, y) == ' ')
+    {
+        player->x = x;
+        player->y = y;
     }
 }
 
+// Draw the part of the map around the player and put the player on it
+void view_draw(const nconio_tilemap *map, player_t *player)
+{
+    int cols = conw();
+    int rows = conh();
+    int camx = camera_at(player->x, cols, MAP_W);
+    int camy = camera_at(player->y, rows, MAP_H);
+
+    // Only the tiles that changed reach the terminal, when the camera moved
+    // the terminal shifts what it shows
+    nconio_drawtilemap(map, camx, camy, 0, 0, cols, rows);
+    nconio_movesurface(player->sprite, player->x - camx, player->y - camy); // Nothing to do if it did not move
+}
+
 int main(void)
 {
     nconioinit();
     hidecursor();
     clrscr();
 
-    player_t *player = player_new(11, 11);
-
     int input = 0; // User input
-    int rows = conh();
-    int cols = conw();
 
-    char **map = map_new(rows, cols);
+    nconio_tilemap *map = map_new();
+    player_t *player = player_new(11, 11);
 
-    map_print(map, rows, cols);
-    putchat(player->ch, player->x, player->y);
+    nconio_beginframe(); // Draw the view and the player with a single flush
+    view_draw(map, player);
+    nconio_endframe();
 
     while ((input = getchr()) != 27) // ESC to exit
     {
-        if (consizechanged())
-        {
-            clrscr();
-
-            player->prevch = getchat(player->x, player->y);
-            player->nextch = player->prevch;
-            map_print(map, rows, cols);
-            putchat(player->ch, player->x, player->y);
-        }
-
-        player_move(player, map, input, rows, cols);
-
-        // If position changed, update screen
-        if (player->prevx != player->x || player->prevy != player->y)
-        {
-            putchat(player->prevch, player->prevx, player->prevy);
-            player->prevch = player->nextch;
-            putchat(player->ch, player->x, player->y);
-        }
+        nconio_beginframe();
+        player_move(player, map, input);
+        view_draw(map, player); // Also fills a resized screen
+        nconio_endframe();
     }
 
-    free(player);
-    map_free(map, rows);
+    player_free(player);
+    nconio_freetilemap(map);
     clrscr();        // Clear screen on exit
     nconiocleanup(); // Cleanup
     return 0;
@@ -26,6 +26,11 @@ extern "C"
 #define NCONIO_YELLOW 14
 #define NCONIO_WHITE 15
 
+// Wherever a color is expected, these can be used besides the 16 colors above.
+// Terminals with fewer colors show the nearest color they have.
+#define NCONIO_COLOR256(n) (0x100 | ((n) & 0xff)) // Entry n of the xterm 256-color palette
+#define NCONIO_RGB(r, g, b) (0x1000000 | (((r) & 0xff) << 16) | (((g) & 0xff) << 8) | ((b) & 0xff)) // 24-bit color
+
     // Initialize nconio
     // This must be called before anything else
     void nconioinit(void);
@@ -33,22 +38,72 @@ extern "C"
     // Frees and cleans up memory
     void nconiocleanup(void);
 
-    // Check if a key has been pressed
+    // Check if a key has been pressed, without removing it from the input
     // Returns the virtual key code of the pressed key or 0
     int kbhit(void);
 
     // Returns the virtual key code of the pressed key, blocking execution until input is received.
     int getchr(void);
 
-    // Get the character at position x, y
+    // Get the character at position x, y ('?' for a character put with
+    // nconio_putcp or nconio_pututf8 that is not ASCII, and for both halves of a wide one)
     char getchat(int x, int y);
 
+    // Get the NCONIO_ATTR(fg, bg) text attribute at position x, y
+    unsigned char getattrat(int x, int y);
+
+    // Copy a block of w x h characters (and attributes) with its top left corner
+    // at position x, y into chars (and attrs), rows stride elements apart.
+    // Either pointer may be NULL. Cells outside the console read as '\0' and 0.
+    void getrect(char *chars, unsigned char *attrs, int w, int h, int stride, int x, int y);
+
     // Print character to console
     int putchr(int ch);
 
     // Print character to console at position x, y
     void putchat(char ch, int x, int y);
 
+// Build a text attribute for putrow/putrect from a foreground and background color
+#define NCONIO_ATTR(fg, bg) ((unsigned char)(((bg) << 4) | (fg)))
+
+    // Print a string on one line starting at position x, y.
+    // The string is clipped to the console and the cursor does not move.
+    void putstrat(const char *str, int x, int y);
+
+    // Print count characters on one line starting at position x, y.
+    // attrs holds one NCONIO_ATTR per character, or is NULL to use the current colors.
+    // The row is clipped to the console and the cursor does not move.
+    void putrow(const char *chars, const unsigned char *attrs, int count, int x, int y);
+
+    // Print a block of w x h characters with its top left corner at position x, y.
+    // Row r of the block starts at chars + r * stride (and attrs + r * stride).
+    // attrs may be NULL to use the current colors. The block is clipped to the console.
+    void putrect(const char *chars, const unsigned char *attrs, int w, int h, int stride, int x, int y);
+
+    // Characters beyond ASCII. The char functions above keep working with bytes:
+    // a byte of 0x80 or more that was put with them is read back unchanged by
+    // getchat and sent to the terminal as it is. Between nconioinit and
+    // nconiocleanup up to 1151 different code points above U+FFFF can be drawn,
+    // further ones are drawn as U+FFFD.
+
+    // Get the number of cells a Unicode code point takes: 2 for wide characters
+    // (CJK, most emoji), 0 for combining marks and control characters, else 1
+    int nconio_cpwidth(unsigned int cp);
+
+    // Print a Unicode code point at position x, y with the current colors.
+    // A wide character takes the cell at x + 1 as well, one that does not fit
+    // on the line is drawn as a blank. Code points of width 0 are ignored.
+    void nconio_putcp(unsigned int cp, int x, int y);
+
+    // Print UTF-8 text on one line starting at position x, y, clipped like putstrat.
+    // Invalid bytes are drawn as U+FFFD. Returns the number of cells the text takes.
+    int nconio_pututf8(const char *str, int x, int y);
+
+    // Get the Unicode code point at position x, y, 0 for the right half of a
+    // wide character and for cells outside the console. A byte of 0x80 or more
+    // put with the char functions reads as U+DC80 to U+DCFF.
+    unsigned int nconio_getcp(int x, int y);
+
     // Set cursor position
     void gotoxy(int x, int y);
 
@@ -89,574 +144,7025 @@ extern "C"
     // Make the console cursor visible
     void showcursor(void);
 
+// Text attributes for nconio_makestyle, can be combined with |
+#define NCONIO_BOLD 0x01
+#define NCONIO_UNDERLINE 0x02
+#define NCONIO_REVERSE 0x04
+
+    // Handle of an interned style (see nconio_makestyle)
+    typedef int nconio_style;
+
+    // Get the handle for a combination of foreground and background color (see NCONIO_ colors)
+    // and attributes (see NCONIO_BOLD etc.). The same combination always returns the same handle.
+    // Handle 0 is white on black without attributes. Handles are valid until nconiocleanup.
+    nconio_style nconio_makestyle(int fg, int bg, int attrs);
+
+    // Draw all following cells with the given style.
+    // textcolor and textbackground change the colors of the current style.
+    void nconio_setstyle(nconio_style style);
+
+    // Get the style the next cells will be drawn with
+    nconio_style nconio_getstyle(void);
+
+// Key codes returned by kbhit and getchr, the Windows virtual key codes.
+// Letters are returned as 'A'-'Z' and digits as '0'-'9', also with shift held.
+#define NCONIO_KEY_BACKSPACE 0x08
+#define NCONIO_KEY_TAB 0x09
+#define NCONIO_KEY_ENTER 0x0D
+#define NCONIO_KEY_ESCAPE 0x1B
+#define NCONIO_KEY_SPACE 0x20
+#define NCONIO_KEY_PAGEUP 0x21
+#define NCONIO_KEY_PAGEDOWN 0x22
+#define NCONIO_KEY_END 0x23
+#define NCONIO_KEY_HOME 0x24
+#define NCONIO_KEY_LEFT 0x25
+#define NCONIO_KEY_UP 0x26
+#define NCONIO_KEY_RIGHT 0x27
+#define NCONIO_KEY_DOWN 0x28
+#define NCONIO_KEY_INSERT 0x2D
+#define NCONIO_KEY_DELETE 0x2E
+#define NCONIO_KEY_F1 0x70 // F2 to F12 follow in order
+
+    // A key press
+    typedef struct nconio_keyevent
+    {
+        int key; // Virtual key code (see NCONIO_KEY_ codes)
+        int ch;  // Character the key typed, 0 for keys like the arrows
+    } nconio_keyevent;
+
+    // Get the next key press without removing it from the input.
+    // Returns 0 if no key has been pressed. ev may be NULL.
+    int nconio_peekkey(nconio_keyevent *ev);
+
+    // Remove the next key press from the input, blocking until there is one.
+    // Returns its key code. ev may be NULL.
+    int nconio_getkey(nconio_keyevent *ev);
+
+// Flush modes (see nconio_setflushmode)
+#define NCONIO_FLUSH_EACH 0 // Every drawing call is flushed to the terminal right away (default)
+#define NCONIO_FLUSH_AUTO 1 // Drawing is collected and flushed once before input is read
+
+    // Output cost of a frame (see nconio_getstats). Define NCONIO_NO_STATS
+    // before including nconio.h to compile the counting out, all counters stay 0 then.
+    typedef struct nconio_stats
+    {
+        unsigned long flushes;  // Number of times output was pushed to the terminal
+        unsigned long bytes;    // Number of bytes written to the terminal (not reported by ncurses, 0 there)
+        unsigned long writes;   // Number of write calls to the terminal (not reported by ncurses, 0 there)
+        unsigned long moves;    // Number of cursor movements sent
+        unsigned long attrs;    // Number of color and attribute changes sent
+        unsigned long diffed;   // Number of cells compared with what the terminal shows
+        unsigned long emitted;  // Number of cells sent to the terminal
+        unsigned long deferred; // Flushes that waited for the terminal to take earlier output (see nconio_setoutputlimit)
+    } nconio_stats;
+
+    // Start a frame: drawing calls until the matching nconio_endframe
+    // are collected and sent to the terminal in a single flush.
+    // Frames may be nested, only the outermost nconio_endframe flushes.
+    void nconio_beginframe(void);
+
+    // End a frame started with nconio_beginframe and flush its output
+    void nconio_endframe(void);
+
+    // Push all pending output to the terminal now
+    void nconio_flush(void);
+
+    // Set when output is flushed outside of frames (see NCONIO_FLUSH_ constants)
+    void nconio_setflushmode(int mode);
+
+    // Write to the terminal without blocking, with the native VT backend. A flush
+    // sends about kb kilobytes at most, the remaining changes follow with the next
+    // flushes. While the terminal has not taken the output of an earlier flush,
+    // flushes wait and later diff against what was sent, so a slow terminal skips
+    // to the latest frame instead of showing every frame late. Output is written
+    // on while waiting for input or in nconio_wait. 0, the default, writes
+    // blocking. Does nothing with ncurses and on Windows.
+    void nconio_setoutputlimit(int kb);
+
+    // Get the output cost of the last completed frame and the total since nconioinit.
+    // A frame completes at nconio_endframe, or with NCONIO_FLUSH_AUTO at every automatic flush.
+    // Either pointer may be NULL.
+    void nconio_getstats(nconio_stats *frame, nconio_stats *total);
+
+    // Set all output counters to 0, for the frame in progress, the last frame and the total
+    void nconio_resetstats(void);
+
+// Events reported by nconio_wait, can be combined
+#define NCONIO_EVENT_KEY 0x01    // A key press is waiting (see kbhit, getchr)
+#define NCONIO_EVENT_RESIZE 0x02 // The console was resized (see consizechanged)
+#define NCONIO_EVENT_TIMER 0x04  // The timer set with nconio_settimer fired
+
+    // Sleep until a key is pressed, the console is resized, the timer fires or
+    // timeout_ms milliseconds pass (a negative timeout waits forever).
+    // Pending output is flushed first. Returns the NCONIO_EVENT_ flags of what
+    // happened, 0 if the timeout passed. Key presses are not removed from the input.
+    int nconio_wait(int timeout_ms);
+
+    // Make nconio_wait wake up with NCONIO_EVENT_TIMER every interval_ms
+    // milliseconds. 0 stops the timer.
+    void nconio_settimer(int interval_ms);
+
+    // Frame times of the frames nconio_run rendered last, in milliseconds
+    typedef struct nconio_frametime
+    {
+        double min_ms;
+        double avg_ms;
+        double p99_ms; // 99 of 100 frames took at most this long
+    } nconio_frametime;
+
+    // Frame pacing statistics (see nconio_getframestats)
+    typedef struct nconio_framestats
+    {
+        unsigned long frames;    // Frames rendered
+        unsigned long skipped;   // Updates not followed by a render because the loop fell behind
+        nconio_frametime update; // Time spent in update per frame
+        nconio_frametime render; // Time spent in render and flushing its output
+        nconio_frametime frame;  // Time from the start of a frame to the start of the next
+    } nconio_framestats;
+
+    // Run a game loop at fps frames per second. update is called with a fixed
+    // time step of dt seconds, as often as the clock demands, and returns 0 to
+    // end the loop. render is then called inside a frame (see nconio_beginframe).
+    // If the loop falls behind, renders are skipped to catch up.
+    // Returns 0 if fps is not positive or update is NULL, otherwise 1.
+    int nconio_run(int fps, int (*update)(void *user, double dt), void (*render)(void *user), void *user);
+
+    // Get the frame count and min/avg/p99 frame times of the last 128 frames of nconio_run
+    void nconio_getframestats(nconio_framestats *stats);
+
+    // An off-screen layer of cells (see nconio_newsurface)
+    typedef struct nconio_surface nconio_surface;
+
+    // Create a transparent, visible surface of w x h cells at position 0, 0.
+    // Surfaces are composited over the screen at every flush: each cell shows the
+    // surface with the highest z that is not transparent there, or else what was
+    // drawn on the screen itself. Only the areas that changed are composited
+    // again. Returns NULL if out of memory.
+    nconio_surface *nconio_newsurface(int w, int h, int z);
+
+    // Free a surface, uncovering what lies below it
+    void nconio_freesurface(nconio_surface *surface);
+
+    // Make putchat, putstrat, putrow, putrect and clrscr draw on surface, at
+    // coordinates relative to it. NULL draws on the screen again. Character '\0'
+    // is transparent and clrscr makes the whole surface transparent.
+    void nconio_settarget(nconio_surface *surface);
+
+    // Move the top left corner of a surface to position x, y of the screen
+    void nconio_movesurface(nconio_surface *surface, int x, int y);
+
+    // Show (1) or hide (0) a surface
+    void nconio_showsurface(nconio_surface *surface, int visible);
+
+#define NCONIO_CHUNK 32 // A tilemap is stored in chunks of NCONIO_CHUNK x NCONIO_CHUNK tiles
+
+    // A map of tiles, as large as needed (see nconio_newtilemap)
+    typedef struct nconio_tilemap nconio_tilemap;
+
+    // Create an empty tilemap. A tile is a number from 0 to 255 and looks like
+    // the char of the same number drawn with putchat, until nconio_deftile gives
+    // it a look of its own. The map is kept in chunks, and chunks where no tile
+    // was set take no memory. Tiles may have negative coordinates.
+    // Returns NULL if out of memory.
+    nconio_tilemap *nconio_newtilemap(void);
+
+    // Free a tilemap and its chunks
+    void nconio_freetilemap(nconio_tilemap *map);
+
+    // Draw tile number tile as code point cp in a style (see nconio_makestyle),
+    // or in the current style if style is -1. Code points that are not one cell
+    // wide are drawn as blanks.
+    void nconio_deftile(nconio_tilemap *map, int tile, unsigned int cp, nconio_style style);
+
+    // Copy NCONIO_CHUNK x NCONIO_CHUNK tiles, row by row, into the chunk at cx, cy,
+    // which holds the tiles from cx * NCONIO_CHUNK, cy * NCONIO_CHUNK on.
+    // NULL empties the chunk and frees it. Returns 0 if out of memory.
+    int nconio_setchunk(nconio_tilemap *map, int cx, int cy, const unsigned char *tiles);
+
+    // Set the tile at x, y of the map. Returns 0 if out of memory.
+    int nconio_settile(nconio_tilemap *map, int x, int y, int tile);
+
+    // Get the tile at x, y of the map, 0 where no chunk was set
+    int nconio_gettile(const nconio_tilemap *map, int x, int y);
+
+    // Draw the w x h tiles of the map from mapx, mapy on, the view of a camera,
+    // at x, y of the screen or the target surface (see nconio_settarget).
+    // Drawing the view again after the camera moved sends only what changed,
+    // the VT backend shifts what the terminal shows along with the map.
+    void nconio_drawtilemap(const nconio_tilemap *map, int mapx, int mapy, int x, int y, int w, int h);
+
+#ifdef NCONIO_THREADS
+// What a drawing call does when the render thread's queue is full (see nconio_startrender)
+#define NCONIO_RENDER_BLOCK 0    // Wait for room, every frame is shown
+#define NCONIO_RENDER_COALESCE 1 // Never wait, only the latest state is shown
+
+    // Move terminal output to a render thread (Linux and macOS, link with -pthread).
+    // Drawing calls (put*, gotoxy, clrscr, text colors, styles, cursor, frames,
+    // flushes and surfaces) are queued in a ring of queue_kb kilobytes (0 for
+    // 1024) and return right away. The render thread applies them and writes
+    // to the terminal. No call is ever dropped. With NCONIO_RENDER_BLOCK, a
+    // drawing call that finds the queue full waits until the render thread has
+    // taken in what is queued. With NCONIO_RENDER_COALESCE it applies the queue
+    // to the screen itself instead of waiting for the terminal, and the render
+    // thread shows only the latest state, skipping the frames in between.
+    // Calls that read the screen (getchat, conw, nconio_makestyle, ...) wait
+    // while the render thread applies calls, but not while the native VT
+    // backend writes to the terminal.
+    // Returns 0 if the thread could not be started.
+    int nconio_startrender(int queue_kb, int policy);
+
+    // Wait until everything queued has been drawn and stop the render thread.
+    // nconiocleanup does this as well.
+    void nconio_stoprender(void);
+
+    // Number of frames NCONIO_RENDER_COALESCE skipped, drawn over before they reached the terminal
+    unsigned long nconio_droppedframes(void);
+#endif
+
+#ifdef NCONIO_VT
+    // A cell of the headless terminal (see nconio_headless_cell)
+    typedef struct nconio_vtcell
+    {
+        unsigned int ch; // Code point, 0 for the right half of a wide character
+        int fg;    // Color the escape sequences set (see NCONIO_ colors), -1 for the terminal default
+        int bg;
+        int attrs; // NCONIO_BOLD, NCONIO_UNDERLINE, NCONIO_REVERSE
+    } nconio_vtcell;
+
+    // Start nconio without a terminal, instead of nconioinit. Output goes to an
+    // in-memory terminal of w x h cells that parses the bytes nconio emits, and
+    // input only comes from nconio_headless_input. End with nconiocleanup.
+    // For tests and benchmarks that run without a tty.
+    void nconio_initheadless(int w, int h);
+
+    // Get the cell at x, y of the headless terminal as its escape sequences left it.
+    // Returns 0 if x, y is outside of it. cell may be NULL.
+    int nconio_headless_cell(int x, int y, nconio_vtcell *cell);
+
+    // Get the cursor position of the headless terminal. Returns whether the cursor is visible.
+    int nconio_headless_cursor(int *x, int *y);
+
+    // Queue bytes as if they were typed, escape sequences included
+    void nconio_headless_input(const char *bytes, int count);
+
+    // Resize the headless terminal, nconio sees it like a resized window
+    void nconio_headless_resize(int w, int h);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
 
 #ifdef NCONIO_IMPL
 
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// The screen diff compares cells with SSE2 where the compiler targets it, and
+// with AVX2 when GCC or Clang find it on the CPU at run time
+#if defined(__SSE2__) && !defined(NCONIO_NOSIMD)
+#define __NCONIO_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define __NCONIO_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-#if defined(_WIN32) || defined(_WIN64)
-    // ##################################################################
-    //    Windows
-    // ##################################################################
+// ##################################################################
+//    Common
+// ##################################################################
 
-#include <windows.h>
-    // Global variable to hold the current text and background color attributes
-    static WORD __nconio_currentAttributes = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
+static int __nconio_frame_depth = 0;                  // Nesting level of nconio_beginframe
+static int __nconio_flush_mode = NCONIO_FLUSH_EACH;   // See nconio_setflushmode
+static int __nconio_flush_pending = 0;                // Drawing happened since the last flush
+static nconio_stats __nconio_stats_frame;           // Cost of the frame in progress
+static nconio_stats __nconio_stats_lastframe;       // Cost of the last completed frame
+static nconio_stats __nconio_stats_total;           // Cost since nconioinit
 
-    BOOL WINAPI __ctrl_handler(DWORD fdwCtrlType)
+// Add n to an output counter of the frame and the total
+#ifndef NCONIO_NO_STATS
+#define __NCONIO_COUNT(counter, n) (__nconio_stats_frame.counter += (unsigned long)(n), __nconio_stats_total.counter += (unsigned long)(n))
+#else
+#define __NCONIO_COUNT(counter, n) ((void)0)
+#endif
+
+// Calls queued for the render thread (see nconio_startrender), there is one on Linux and macOS
+#define __NCONIO_RT_PUTCHR 0
+#define __NCONIO_RT_PUTCHAT 1
+#define __NCONIO_RT_PUTROW 2
+#define __NCONIO_RT_GOTOXY 3
+#define __NCONIO_RT_CLRSCR 4
+#define __NCONIO_RT_TEXTCOLOR 5
+#define __NCONIO_RT_TEXTBACKGROUND 6
+#define __NCONIO_RT_SETSTYLE 7
+#define __NCONIO_RT_HIDECURSOR 8
+#define __NCONIO_RT_SHOWCURSOR 9
+#define __NCONIO_RT_BEGINFRAME 10
+#define __NCONIO_RT_ENDFRAME 11
+#define __NCONIO_RT_FLUSH 12
+#define __NCONIO_RT_SETFLUSHMODE 13
+#define __NCONIO_RT_SYNCINPUT 14
+#define __NCONIO_RT_PUTCP 15
+#define __NCONIO_RT_PUTUTF8 16
+#define __NCONIO_RT_TILELOOKS 17
+#define __NCONIO_RT_PUTTILES 18
+#define __NCONIO_RT_SETTARGET 19
+#define __NCONIO_RT_MOVESURFACE 20
+#define __NCONIO_RT_SHOWSURFACE 21
+#define __NCONIO_RT_FREESURFACE 22
+
+#if defined(NCONIO_THREADS) && !defined(_WIN32) && !defined(_WIN64)
+// Implemented per platform: whether calls of this thread are queued instead of run
+static int __nconio_rt_active(void);
+// Queue a call with up to four arguments and len bytes of data
+static void __nconio_rt_push(int op, int a, int b, int c, int d, const void *data, int len);
+// Queue a call and return where its len bytes of data go, NULL if it was dropped. Finish with __nconio_rt_end.
+static char *__nconio_rt_begin(int op, int a, int b, int c, int d, int len);
+static void __nconio_rt_end(void);
+// Keep the render thread from touching the screen while the calling thread reads it
+static void __nconio_rt_lock(void);
+static void __nconio_rt_unlock(void);
+#else
+#define __nconio_rt_active() 0
+#define __nconio_rt_push(op, a, b, c, d, data, len) ((void)0)
+#define __nconio_rt_begin(op, a, b, c, d, len) ((char *)NULL)
+#define __nconio_rt_end() ((void)0)
+#define __nconio_rt_lock() ((void)0)
+#define __nconio_rt_unlock() ((void)0)
+#endif
+
+// Implemented per platform: sends everything drawn since the last call to the terminal
+// and returns the number of bytes written (0 where that is not known)
+static unsigned long __nconio_present(void);
+
+// Defined with the surfaces: composite them into the screen
+static void __nconio_compose(void);
+
+void nconio_resetstats(void)
+{
+    __nconio_rt_lock();
+    memset(&__nconio_stats_frame, 0, sizeof(nconio_stats));
+    memset(&__nconio_stats_lastframe, 0, sizeof(nconio_stats));
+    memset(&__nconio_stats_total, 0, sizeof(nconio_stats));
+    __nconio_rt_unlock();
+}
+
+static void __nconio_completeframe(void)
+{
+    __nconio_stats_lastframe = __nconio_stats_frame;
+    memset(&__nconio_stats_frame, 0, sizeof(nconio_stats));
+}
+
+// Called by every drawing function after it changed the screen
+static void __nconio_touch(void)
+{
+    __nconio_flush_pending = 1;
+    if (__nconio_frame_depth == 0 && __nconio_flush_mode == NCONIO_FLUSH_EACH)
     {
-        switch (fdwCtrlType)
-        {
-        case CTRL_C_EVENT:
-            return TRUE; // Handle the CTRL-C signal
-        default:
-            return FALSE;
-        }
+        nconio_flush();
     }
+}
 
-    void nconioinit(void)
+// Called before blocking on or polling for input, so the user sees what was drawn
+static void __nconio_syncinput(void)
+{
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_SYNCINPUT, 0, 0, 0, 0, NULL, 0);
+        return;
+    }
+    if (__nconio_frame_depth == 0 && __nconio_flush_pending)
     {
-        __nconio_currentAttributes = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
+        nconio_flush();
+        __nconio_completeframe();
+    }
+}
 
-        // Disable Ctrl-C
-        SetConsoleCtrlHandler((PHANDLER_ROUTINE)__ctrl_handler, TRUE);
+void nconio_beginframe(void)
+{
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_BEGINFRAME, 0, 0, 0, 0, NULL, 0);
+        return;
     }
+    __nconio_frame_depth++;
+}
 
-    void nconiocleanup(void)
+void nconio_endframe(void)
+{
+    if (__nconio_rt_active())
     {
-        showcursor();          // Show cursor on exit
-        textcolorreset();      // Reset the text color
-        textbackgroundreset(); // reset the background color
+        __nconio_rt_push(__NCONIO_RT_ENDFRAME, 0, 0, 0, 0, NULL, 0);
+        return;
+    }
+    if (__nconio_frame_depth == 0)
+    {
+        return;
+    }
 
-        // Re-enable Ctrl-C
-        SetConsoleCtrlHandler((PHANDLER_ROUTINE)__ctrl_handler, FALSE);
+    if (--__nconio_frame_depth == 0)
+    {
+        nconio_flush();
+        __nconio_completeframe();
     }
+}
 
-    // Custom implementation of kbhit for Windows
-    int kbhit(void)
+void nconio_flush(void)
+{
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_FLUSH, 0, 0, 0, 0, NULL, 0);
+        return;
+    }
+    if (!__nconio_flush_pending)
     {
-        HANDLE stdinHandle = GetStdHandle(STD_INPUT_HANDLE);
-        DWORD numberOfEvents = 0;
+        return;
+    }
 
-        GetNumberOfConsoleInputEvents(stdinHandle, &numberOfEvents);
+    __nconio_flush_pending = 0;
+    __nconio_compose();
+    unsigned long bytes = __nconio_present();
+    __NCONIO_COUNT(flushes, 1);
+    __NCONIO_COUNT(bytes, bytes);
+    (void)bytes;
+}
 
-        if (numberOfEvents > 0)
-        {
-            INPUT_RECORD *eventBuffer = (INPUT_RECORD *)malloc(sizeof(INPUT_RECORD) * numberOfEvents);
-            DWORD numEventsRead = 0;
+void nconio_setflushmode(int mode)
+{
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_SETFLUSHMODE, mode, 0, 0, 0, NULL, 0);
+        return;
+    }
+    __nconio_flush_mode = mode;
+    if (mode == NCONIO_FLUSH_EACH && __nconio_frame_depth == 0)
+    {
+        nconio_flush();
+    }
+}
+
+void nconio_getstats(nconio_stats *frame, nconio_stats *total)
+{
+    __nconio_rt_lock();
+    if (frame)
+    {
+        *frame = __nconio_stats_lastframe;
+    }
+    if (total)
+    {
+        *total = __nconio_stats_total;
+    }
+    __nconio_rt_unlock();
+}
 
-            PeekConsoleInput(stdinHandle, eventBuffer, numberOfEvents, &numEventsRead);
+// ##################################################################
+//    Common: frame pacing
+// ##################################################################
 
-            for (DWORD i = 0; i < numEventsRead; ++i)
-            {
-                if (eventBuffer[i].EventType == KEY_EVENT && eventBuffer[i].Event.KeyEvent.bKeyDown)
-                {
-                    int scan_code = eventBuffer[i].Event.KeyEvent.wVirtualKeyCode;
-                    free(eventBuffer);
-                    return scan_code;
-                }
-            }
-            free(eventBuffer);
-        }
-        return 0;
+#define __NCONIO_PACEWINDOW 128 // Frames the frame time statistics cover
+
+static double __nconio_pace_update[__NCONIO_PACEWINDOW]; // Rolling frame times in milliseconds
+static double __nconio_pace_render[__NCONIO_PACEWINDOW];
+static double __nconio_pace_frame[__NCONIO_PACEWINDOW];
+static int __nconio_pace_count = 0; // Frames in the window
+static int __nconio_pace_next = 0;  // Slot of the next frame
+static unsigned long __nconio_pace_frames = 0;
+static unsigned long __nconio_pace_skipped = 0;
+
+// Implemented per platform: monotonic time in microseconds and sleeping
+static long long __nconio_now(void);
+static void __nconio_sleep(long long us);
+
+static int __nconio_comparetimes(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+    return da < db ? -1 : da > db;
+}
+
+static void __nconio_frametimeof(const double *times, nconio_frametime *out)
+{
+    double sorted[__NCONIO_PACEWINDOW];
+    double sum = 0;
+
+    memset(out, 0, sizeof(*out));
+    if (__nconio_pace_count == 0)
+    {
+        return;
+    }
+    memcpy(sorted, times, (size_t)__nconio_pace_count * sizeof(double));
+    qsort(sorted, (size_t)__nconio_pace_count, sizeof(double), __nconio_comparetimes);
+    for (int i = 0; i < __nconio_pace_count; i++)
+    {
+        sum += sorted[i];
     }
+    out->min_ms = sorted[0];
+    out->avg_ms = sum / __nconio_pace_count;
+    out->p99_ms = sorted[(__nconio_pace_count * 99 - 1) / 100];
+}
+
+int nconio_run(int fps, int (*update)(void *user, double dt), void (*render)(void *user), void *user)
+{
+    long long step, next, framestart = -1;
+    int running = 1, behind = 0;
 
-    // Custom implementation of getchr for Windows
-    int getchr(void)
+    if (fps <= 0 || update == NULL)
     {
-        DWORD read;
-        INPUT_RECORD inputRecord;
-        HANDLE hInput = GetStdHandle(STD_INPUT_HANDLE);
-        DWORD prev_mode;
+        return 0;
+    }
+    step = 1000000 / fps;
+    next = __nconio_now();
+    __nconio_pace_count = 0;
+    __nconio_pace_next = 0;
+    __nconio_pace_frames = 0;
+    __nconio_pace_skipped = 0;
 
-        GetConsoleMode(hInput, &prev_mode);             // Save the current console mode
-        SetConsoleMode(hInput, ENABLE_PROCESSED_INPUT); // Set mode to allow reading input records
+    while (running)
+    {
+        long long start = __nconio_now(), updated, rendered;
+        int updates = 0;
 
-        while (1)
+        // Catch up with the clock in fixed steps. A backlog of more than a few
+        // steps is dropped rather than letting the loop spiral.
+        while (running && start >= next)
         {
-            // Read the next input event
-            ReadConsoleInput(hInput, &inputRecord, 1, &read);
-            if (inputRecord.EventType == KEY_EVENT && inputRecord.Event.KeyEvent.bKeyDown)
+            running = update(user, (double)step / 1000000);
+            next += step;
+            if (++updates == 5 && __nconio_now() >= next)
             {
-                // If it's a keydown event, return the virtual key code
-                SetConsoleMode(hInput, prev_mode); // Restore the original console mode
-                return inputRecord.Event.KeyEvent.wVirtualKeyCode;
+                next = __nconio_now() + step;
+                break;
             }
         }
-    }
-
-    // Custom implementation of clrscr for Windows
-    void clrscr(void)
-    {
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-        COORD coordScreen = {0, 0}; // Home for the cursor
-        DWORD cCharsWritten;
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        DWORD dwConSize;
-
-        // Get the number of character cells in the current buffer
-        if (!GetConsoleScreenBufferInfo(hConsole, &csbi))
+        if (!running)
         {
-            return;
+            break;
         }
+        if (updates == 0)
+        {
+            __nconio_sleep(next - start);
+            continue;
+        }
+        updated = __nconio_now();
 
-        dwConSize = csbi.dwSize.X * csbi.dwSize.Y;
-
-        // Fill the entire screen with blanks
-        if (!FillConsoleOutputCharacter(hConsole,        // Handle to console screen buffer
-                                        (TCHAR)' ',      // Character to write to the buffer
-                                        dwConSize,       // Number of cells to write
-                                        coordScreen,     // Coordinates of first cell
-                                        &cCharsWritten)) // Receive number of characters written
+        // When output falls behind the next update is due already: skip the
+        // render, but never more than a few in a row
+        if (updated >= next && behind < 4)
         {
-            return;
+            behind++;
+            __nconio_pace_skipped += (unsigned long)updates;
+            continue;
         }
+        behind = 0;
+        __nconio_pace_skipped += (unsigned long)updates - 1; // Caught up without rendering in between
 
-        // Get the current text attribute
-        if (!GetConsoleScreenBufferInfo(hConsole, &csbi))
+        nconio_beginframe();
+        if (render)
         {
-            return;
+            render(user);
         }
+        nconio_endframe();
+        rendered = __nconio_now();
 
-        // Set the buffer's attributes accordingly
-        if (!FillConsoleOutputAttribute(hConsole,         // Handle to console screen buffer
-                                        csbi.wAttributes, // Character attributes to use
-                                        dwConSize,        // Number of cells to set attribute
-                                        coordScreen,      // Coordinates of first cell
-                                        &cCharsWritten))  // Receive number of characters written
+        __nconio_pace_update[__nconio_pace_next] = (double)(updated - start) / 1000;
+        __nconio_pace_render[__nconio_pace_next] = (double)(rendered - updated) / 1000;
+        __nconio_pace_frame[__nconio_pace_next] = framestart < 0 ? (double)step / 1000 : (double)(start - framestart) / 1000;
+        __nconio_pace_next = (__nconio_pace_next + 1) % __NCONIO_PACEWINDOW;
+        if (__nconio_pace_count < __NCONIO_PACEWINDOW)
         {
-            return;
+            __nconio_pace_count++;
         }
+        __nconio_pace_frames++;
+        framestart = start;
 
-        // Put the cursor at its home coordinates
-        SetConsoleCursorPosition(hConsole, coordScreen);
+        __nconio_sleep(next - __nconio_now());
     }
+    return 1;
+}
 
-    void gotoxy(int x, int y)
+void nconio_getframestats(nconio_framestats *stats)
+{
+    if (stats == NULL)
     {
-        // Create a COORD structure with the desired cursor position
-        COORD coord = {(SHORT)x, (SHORT)y};
+        return;
+    }
+    stats->frames = __nconio_pace_frames;
+    stats->skipped = __nconio_pace_skipped;
+    __nconio_frametimeof(__nconio_pace_update, &stats->update);
+    __nconio_frametimeof(__nconio_pace_render, &stats->render);
+    __nconio_frametimeof(__nconio_pace_frame, &stats->frame);
+}
 
-        // Get the console output handle
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+// ##################################################################
+//    Common: keyboard input
+// ##################################################################
 
-        // Set the cursor position
-        SetConsoleCursorPosition(hConsole, coord);
-    }
+#define __NCONIO_KEYQUEUE 256 // Key events that can be queued
 
-    int putchr(int ch)
-    {
-        // Get the standard output handle
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-        DWORD written;
+static nconio_keyevent __nconio_keys[__NCONIO_KEYQUEUE]; // Ring buffer of key events
+static int __nconio_keyhead = 0;                         // Next event to return
+static int __nconio_keycount = 0;
+static unsigned char __nconio_inbuf[256]; // Input bytes not decoded yet, e.g. half an escape sequence
+static int __nconio_inlen = 0;
 
-        // Write the character to the console
-        if (WriteConsole(hConsole, &ch, 1, &written, NULL))
-        {
-            return ch; // Return the character written if successful
-        }
+// Implemented per platform: waits up to timeout_ms (forever if negative) for
+// input and queues the key events. Returns whether any key event was queued,
+// or -1 if no input can come any more (end of input).
+static int __nconio_pollinput(int timeout_ms);
 
-        return 0; // Return 0 if there was an error
+static void __nconio_pushkey(int key, int ch)
+{
+    if (__nconio_keycount == __NCONIO_KEYQUEUE)
+    {
+        return; // Queue full, the key is lost
     }
+    nconio_keyevent *ev = &__nconio_keys[(__nconio_keyhead + __nconio_keycount) % __NCONIO_KEYQUEUE];
+    ev->key = key;
+    ev->ch = ch;
+    __nconio_keycount++;
+}
 
-    void putchat(char ch, int x, int y)
+static void __nconio_resetinput(void)
+{
+    __nconio_keyhead = 0;
+    __nconio_keycount = 0;
+    __nconio_inlen = 0;
+}
+
+// Key code of a typed character, as the Windows virtual key of a US keyboard
+static int __nconio_keyofchar(int ch)
+{
+    static const char *shifted = ")!@#$%^&*(";
+    static const char *oem = ";:=+,<-_.>/?`~[{\\|]}'\"";
+    static const int oemkeys[] = {0xBA, 0xBB, 0xBC, 0xBD, 0xBE, 0xBF, 0xC0, 0xDB, 0xDC, 0xDD, 0xDE};
+
+    if (ch >= 'a' && ch <= 'z')
     {
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-        COORD pos = {(SHORT)x, (SHORT)y};
-        DWORD written;
-        WriteConsoleOutputCharacter(hConsole, &ch, 1, pos, &written);
+        return ch - 'a' + 'A';
     }
-
-    int wherex(void)
+    if ((ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == ' ')
     {
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-
-        if (GetConsoleScreenBufferInfo(hConsole, &csbi))
+        return ch;
+    }
+    switch (ch)
+    {
+    case '\r':
+    case '\n':
+        return NCONIO_KEY_ENTER;
+    case '\t':
+        return NCONIO_KEY_TAB;
+    case 0x08:
+    case 0x7f:
+        return NCONIO_KEY_BACKSPACE;
+    case 0x1b:
+        return NCONIO_KEY_ESCAPE;
+    }
+    if (ch >= 1 && ch <= 26)
+    {
+        return 'A' + ch - 1; // Ctrl + letter
+    }
+    if (ch > 0 && ch < 0x80)
+    {
+        const char *p = strchr(shifted, ch);
+        if (p)
         {
-            // Subtracting the starting X coordinate to get the relative position
-            return csbi.dwCursorPosition.X; // Return the X coordinate
+            return '0' + (int)(p - shifted);
+        }
+        p = strchr(oem, ch);
+        if (p)
+        {
+            return oemkeys[(p - oem) / 2];
         }
-        return -1; // Return -1 on error
     }
+    return ch;
+}
 
-    int wherey(void)
+// Key code of the final byte of a CSI or SS3 sequence with its first parameter
+static int __nconio_keyofsequence(int final, int param)
+{
+    static const int tilde[] = {
+        0, NCONIO_KEY_HOME, NCONIO_KEY_INSERT, NCONIO_KEY_DELETE, NCONIO_KEY_END,   // 0-4
+        NCONIO_KEY_PAGEUP, NCONIO_KEY_PAGEDOWN, NCONIO_KEY_HOME, NCONIO_KEY_END, 0, // 5-9
+        0, NCONIO_KEY_F1, NCONIO_KEY_F1 + 1, NCONIO_KEY_F1 + 2, NCONIO_KEY_F1 + 3,  // 10-14
+        NCONIO_KEY_F1 + 4, 0, NCONIO_KEY_F1 + 5, NCONIO_KEY_F1 + 6, NCONIO_KEY_F1 + 7, // 15-19
+        NCONIO_KEY_F1 + 8, NCONIO_KEY_F1 + 9, 0, NCONIO_KEY_F1 + 10, NCONIO_KEY_F1 + 11, // 20-24
+    };
+
+    switch (final)
     {
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    case 'A':
+        return NCONIO_KEY_UP;
+    case 'B':
+        return NCONIO_KEY_DOWN;
+    case 'C':
+        return NCONIO_KEY_RIGHT;
+    case 'D':
+        return NCONIO_KEY_LEFT;
+    case 'H':
+        return NCONIO_KEY_HOME;
+    case 'F':
+        return NCONIO_KEY_END;
+    case 'P':
+    case 'Q':
+    case 'R':
+    case 'S':
+        return NCONIO_KEY_F1 + final - 'P';
+    case '~':
+        return param >= 0 && param < (int)(sizeof(tilde) / sizeof(tilde[0])) ? tilde[param] : 0;
+    }
+    return 0;
+}
 
-        if (GetConsoleScreenBufferInfo(hConsole, &csbi))
+// Decode one key from the start of s. Returns the number of bytes used, or 0
+// if s holds the start of an escape sequence and more bytes are needed.
+// If complete is set no more bytes will follow, and a lone ESC is the Escape key.
+static int __nconio_decodekey(const unsigned char *s, int n, int complete, int *key, int *ch)
+{
+    *key = 0;
+    *ch = 0;
+    if (s[0] != 0x1b || (n == 1 && complete))
+    {
+        *ch = s[0];
+        *key = __nconio_keyofchar(s[0]);
+        return 1;
+    }
+    if (n < 2)
+    {
+        return 0;
+    }
+
+    if (s[1] == '[' || s[1] == 'O')
+    {
+        int i = 2, param = -1;
+
+        // Linux console F1-F5: ESC [ [ A-E
+        if (s[1] == '[' && n > 2 && s[2] == '[')
         {
-            // Subtracting the starting Y coordinate to get the relative position
-            return csbi.dwCursorPosition.Y; // Return the Y coordinate
+            if (n < 4)
+            {
+                return complete ? 3 : 0;
+            }
+            *key = s[3] >= 'A' && s[3] <= 'E' ? NCONIO_KEY_F1 + s[3] - 'A' : 0;
+            return 4;
         }
-        return -1; // Return -1 on error
+
+        // Parameter bytes, the first number is what tells keys apart (modifiers are ignored)
+        for (; i < n && s[i] >= 0x20 && s[i] <= 0x3f; i++)
+        {
+            if (s[i] >= '0' && s[i] <= '9' && (param >= 0 || i == 2))
+            {
+                param = (param < 0 ? 0 : param * 10) + s[i] - '0';
+            }
+            else if (param >= 0 && s[i] == ';')
+            {
+                break;
+            }
+        }
+        for (; i < n && s[i] >= 0x20 && s[i] <= 0x3f; i++)
+        {
+        }
+        if (i >= n)
+        {
+            return complete ? n : 0;
+        }
+        *key = __nconio_keyofsequence(s[i], param);
+        return i + 1;
     }
 
-    void textcolor(int color)
+    // Alt + key arrives as ESC followed by the key
+    *ch = s[1];
+    *key = __nconio_keyofchar(s[1]);
+    return 2;
+}
+
+// Turn the bytes in __nconio_inbuf into key events, keeping an incomplete
+// escape sequence at the end unless complete is set
+static void __nconio_decodeinput(int complete)
+{
+    int pos = 0;
+    while (pos < __nconio_inlen)
     {
-        // Map conio.h colors to Windows console foreground colors
-        WORD winColor = 0;
-        switch (color)
+        int key, ch;
+        int used = __nconio_decodekey(__nconio_inbuf + pos, __nconio_inlen - pos, complete, &key, &ch);
+        if (used == 0)
         {
-        case NCONIO_BLACK:
-            winColor = 0;
-            break;
-        case NCONIO_BLUE:
-            winColor = FOREGROUND_BLUE;
-            break;
-        case NCONIO_GREEN:
-            winColor = FOREGROUND_GREEN;
-            break;
-        case NCONIO_CYAN:
-            winColor = FOREGROUND_GREEN | FOREGROUND_BLUE;
-            break;
-        case NCONIO_RED:
-            winColor = FOREGROUND_RED;
-            break;
-        case NCONIO_MAGENTA:
-            winColor = FOREGROUND_RED | FOREGROUND_BLUE;
-            break;
-        case NCONIO_BROWN:
-            winColor = FOREGROUND_RED | FOREGROUND_GREEN;
-            break;
-        case NCONIO_LIGHTGRAY:
-            winColor = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
-            break;
-        case NCONIO_DARKGRAY:
-            winColor = FOREGROUND_INTENSITY;
-            break;
-        case NCONIO_LIGHTBLUE:
-            winColor = FOREGROUND_BLUE | FOREGROUND_INTENSITY;
-            break;
-        case NCONIO_LIGHTGREEN:
-            winColor = FOREGROUND_GREEN | FOREGROUND_INTENSITY;
-            break;
-        case NCONIO_LIGHTCYAN:
-            winColor = FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY;
-            break;
-        case NCONIO_LIGHTRED:
-            winColor = FOREGROUND_RED | FOREGROUND_INTENSITY;
-            break;
-        case NCONIO_LIGHTMAGENTA:
-            winColor = FOREGROUND_RED | FOREGROUND_BLUE | FOREGROUND_INTENSITY;
-            break;
-        case NCONIO_YELLOW:
-            winColor = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY;
-            break;
-        case NCONIO_WHITE:
-            winColor = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY;
-            break;
-        // Default to light gray if an unknown color is specified
-        default:
-            winColor = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
             break;
         }
+        if (key)
+        {
+            __nconio_pushkey(key, ch);
+        }
+        pos += used;
+    }
+    memmove(__nconio_inbuf, __nconio_inbuf + pos, (size_t)(__nconio_inlen - pos));
+    __nconio_inlen -= pos;
+}
 
-        // Apply only the foreground bits, preserving the background
-        __nconio_currentAttributes = (__nconio_currentAttributes & 0xFFF0) | winColor;
+int nconio_peekkey(nconio_keyevent *ev)
+{
+    if (__nconio_keycount == 0 && __nconio_pollinput(0) <= 0)
+    {
+        return 0;
+    }
+    if (ev)
+    {
+        *ev = __nconio_keys[__nconio_keyhead];
+    }
+    return 1;
+}
 
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-        SetConsoleTextAttribute(hConsole, __nconio_currentAttributes);
+int nconio_getkey(nconio_keyevent *ev)
+{
+    __nconio_syncinput();
+    while (__nconio_keycount == 0)
+    {
+        if (__nconio_pollinput(-1) < 0)
+        {
+            // There is nothing to wait for
+            if (ev)
+            {
+                memset(ev, 0, sizeof(*ev));
+            }
+            return 0;
+        }
     }
 
-    void textbackground(int color)
+    nconio_keyevent key = __nconio_keys[__nconio_keyhead];
+    __nconio_keyhead = (__nconio_keyhead + 1) % __NCONIO_KEYQUEUE;
+    __nconio_keycount--;
+    if (ev)
     {
-        // Map conio.h colors to Windows console background colors
-        WORD winColor = 0;
-        switch (color)
+        *ev = key;
+    }
+    return key.key;
+}
+
+int kbhit(void)
+{
+    nconio_keyevent ev;
+    __nconio_syncinput();
+    return nconio_peekkey(&ev) ? ev.key : 0;
+}
+
+int getchr(void)
+{
+    return nconio_getkey(NULL);
+}
+
+// ##################################################################
+//    Common: styles
+// ##################################################################
+
+// An interned combination of colors and attributes. The escape sequence
+// parameters are rendered once, when the style is first used.
+typedef struct __nconio_styledef
+{
+    int fg;          // Foreground color (see NCONIO_ colors)
+    int bg;          // Background color (see NCONIO_ colors)
+    int attrs;       // NCONIO_BOLD, NCONIO_UNDERLINE, NCONIO_REVERSE
+    char fgsgr[20];  // SGR parameters selecting the foreground, e.g. "97"
+    char bgsgr[20];  // SGR parameters selecting the background, e.g. "40"
+    char attrsgr[8]; // SGR parameters turning on the attributes, e.g. "1;4", empty if none
+} __nconio_styledef;
+
+static __nconio_styledef *__nconio_styles = NULL; // Indexed by nconio_style
+static int __nconio_stylecount = 0;
+static int __nconio_stylecap = 0;
+static int *__nconio_stylehash = NULL; // Open addressing table of style handles, -1 if empty
+static int __nconio_stylehashcap = 0;  // Always a power of two, twice __nconio_stylecap
+static int __nconio_attrstyle[256];    // Style handle for each NCONIO_ATTR value, -1 if unknown
+static nconio_style __nconio_style = 0; // Style of the cells drawn next
+
+// Maps NCONIO_ colors (conio order) to ANSI color numbers and back
+static const int __nconio_ansi[8] = {0, 4, 2, 6, 1, 5, 3, 7};
+
+static int __nconio_truecolor = 1; // 24-bit colors are sent as such, otherwise as the nearest 256-color
+
+static int __nconio_validcolor(int color)
+{
+    return (color >= 0 && color <= NCONIO_WHITE) || (color & ~0xff) == 0x100 || (color & ~0xffffff) == 0x1000000;
+}
+
+// Red, green and blue components of any color, the 16 and 256 color palettes as xterm has them
+static void __nconio_colorrgb(int color, int *r, int *g, int *b)
+{
+    static const int levels[6] = {0, 95, 135, 175, 215, 255};
+
+    if (color <= NCONIO_WHITE)
+    {
+        int ansi = __nconio_ansi[color & 7];
+        int on = color >= 8 ? 255 : 205;
+        if (color == NCONIO_DARKGRAY)
         {
-        case NCONIO_BLACK:
-            winColor = 0;
-            break;
-        case NCONIO_BLUE:
-            winColor = BACKGROUND_BLUE;
-            break;
-        case NCONIO_GREEN:
-            winColor = BACKGROUND_GREEN;
-            break;
-        case NCONIO_CYAN:
-            winColor = BACKGROUND_GREEN | BACKGROUND_BLUE;
-            break;
-        case NCONIO_RED:
-            winColor = BACKGROUND_RED;
-            break;
-        case NCONIO_MAGENTA:
-            winColor = BACKGROUND_RED | BACKGROUND_BLUE;
-            break;
-        case NCONIO_BROWN: // There's no direct brown color in background attributes; using yellow instead
-            winColor = BACKGROUND_RED | BACKGROUND_GREEN;
-            break;
-        case NCONIO_LIGHTGRAY:
-            winColor = BACKGROUND_RED | BACKGROUND_GREEN | BACKGROUND_BLUE;
-            break;
-        case NCONIO_DARKGRAY:
-            winColor = BACKGROUND_INTENSITY;
-            break;
-        case NCONIO_LIGHTBLUE:
-            winColor = BACKGROUND_BLUE | BACKGROUND_INTENSITY;
-            break;
-        case NCONIO_LIGHTGREEN:
-            winColor = BACKGROUND_GREEN | BACKGROUND_INTENSITY;
-            break;
-        case NCONIO_LIGHTCYAN:
-            winColor = BACKGROUND_GREEN | BACKGROUND_BLUE | BACKGROUND_INTENSITY;
-            break;
-        case NCONIO_LIGHTRED:
-            winColor = BACKGROUND_RED | BACKGROUND_INTENSITY;
-            break;
-        case NCONIO_LIGHTMAGENTA:
-            winColor = BACKGROUND_RED | BACKGROUND_BLUE | BACKGROUND_INTENSITY;
-            break;
-        case NCONIO_YELLOW:
-            winColor = BACKGROUND_RED | BACKGROUND_GREEN | BACKGROUND_INTENSITY;
-            break;
-        case NCONIO_WHITE:
-            winColor = BACKGROUND_RED | BACKGROUND_GREEN | BACKGROUND_BLUE | BACKGROUND_INTENSITY;
-            break;
-        // Default to no background color (black) if an unknown color is specified
-        default:
-            winColor = 0;
-            break;
+            *r = *g = *b = 127;
+            return;
+        }
+        if (color == NCONIO_LIGHTGRAY)
+        {
+            *r = *g = *b = 229;
+            return;
+        }
+        *r = ansi & 1 ? on : 0;
+        *g = ansi & 2 ? on : 0;
+        *b = ansi & 4 ? on : 0;
+    }
+    else if ((color & ~0xff) == 0x100)
+    {
+        int n = color & 0xff;
+        if (n < 16)
+        {
+            // The first 16 entries are the ANSI colors
+            int conio = __nconio_ansi[n & 7] + (n & 8);
+            __nconio_colorrgb(conio, r, g, b);
+        }
+        else if (n < 232)
+        {
+            n -= 16;
+            *r = levels[n / 36];
+            *g = levels[(n / 6) % 6];
+            *b = levels[n % 6];
+        }
+        else
+        {
+            *r = *g = *b = 8 + (n - 232) * 10;
+        }
+    }
+    else
+    {
+        *r = (color >> 16) & 0xff;
+        *g = (color >> 8) & 0xff;
+        *b = color & 0xff;
+    }
+}
+
+static int __nconio_colordist(int r1, int g1, int b1, int r2, int g2, int b2)
+{
+    return (r1 - r2) * (r1 - r2) + (g1 - g2) * (g1 - g2) + (b1 - b2) * (b1 - b2);
+}
+
+// Nearest entry of the 256-color palette, either from the color cube or the gray ramp
+static int __nconio_nearest256(int r, int g, int b)
+{
+    int q[3], c[3] = {r, g, b};
+    static const int levels[6] = {0, 95, 135, 175, 215, 255};
+
+    for (int i = 0; i < 3; i++)
+    {
+        q[i] = c[i] < 48 ? 0 : c[i] < 115 ? 1 : (c[i] - 35) / 40;
+    }
+    int cube = 16 + 36 * q[0] + 6 * q[1] + q[2];
+    int avg = (r + g + b) / 3;
+    int gray = avg > 238 ? 23 : avg < 8 ? 0 : (avg - 8) / 10;
+    int grayv = 8 + gray * 10;
+
+    if (__nconio_colordist(r, g, b, grayv, grayv, grayv) < __nconio_colordist(r, g, b, levels[q[0]], levels[q[1]], levels[q[2]]))
+    {
+        return 232 + gray;
+    }
+    return cube;
+}
+
+// Nearest of the 16 NCONIO_ colors
+static int __nconio_nearest16(int r, int g, int b)
+{
+    int best = 0, bestdist = -1;
+    for (int color = 0; color <= NCONIO_WHITE; color++)
+    {
+        int cr, cg, cb;
+        __nconio_colorrgb(color, &cr, &cg, &cb);
+        int dist = __nconio_colordist(r, g, b, cr, cg, cb);
+        if (bestdist < 0 || dist < bestdist)
+        {
+            best = color;
+            bestdist = dist;
         }
+    }
+    return best;
+}
+
+// Any color as one of the 16 NCONIO_ colors
+static int __nconio_to16(int color)
+{
+    int r, g, b;
+    if (color <= NCONIO_WHITE)
+    {
+        return color;
+    }
+    __nconio_colorrgb(color, &r, &g, &b);
+    return __nconio_nearest16(r, g, b);
+}
+
+// SGR parameters selecting a color, base is 30 for the foreground and 40 for the background
+static void __nconio_rendercolor(char *buf, size_t size, int color, int base)
+{
+    int r, g, b;
+    if (color <= NCONIO_WHITE)
+    {
+        // Colors 8-15 are the bright variants (90-97 and 100-107)
+        snprintf(buf, size, "%d", (color < 8 ? base : base + 60) + __nconio_ansi[color & 7]);
+    }
+    else if ((color & ~0xff) == 0x100)
+    {
+        snprintf(buf, size, "%d;5;%d", base + 8, color & 0xff);
+    }
+    else if (__nconio_truecolor)
+    {
+        __nconio_colorrgb(color, &r, &g, &b);
+        snprintf(buf, size, "%d;2;%d;%d;%d", base + 8, r, g, b);
+    }
+    else
+    {
+        __nconio_colorrgb(color, &r, &g, &b);
+        snprintf(buf, size, "%d;5;%d", base + 8, __nconio_nearest256(r, g, b));
+    }
+}
+
+static unsigned int __nconio_stylehashof(int fg, int bg, int attrs)
+{
+    unsigned int h = (unsigned int)fg * 2654435761u;
+    h ^= (unsigned int)bg * 2246822519u + (h << 6) + (h >> 2);
+    h ^= (unsigned int)attrs * 3266489917u + (h << 6) + (h >> 2);
+    return h;
+}
+
+static void __nconio_renderstyle(__nconio_styledef *def)
+{
+    int n = 0;
+
+    __nconio_rendercolor(def->fgsgr, sizeof(def->fgsgr), def->fg, 30);
+    __nconio_rendercolor(def->bgsgr, sizeof(def->bgsgr), def->bg, 40);
+
+    def->attrsgr[0] = '\0';
+    if (def->attrs & NCONIO_BOLD)
+    {
+        n += snprintf(def->attrsgr + n, sizeof(def->attrsgr) - n, "%s1", n ? ";" : "");
+    }
+    if (def->attrs & NCONIO_UNDERLINE)
+    {
+        n += snprintf(def->attrsgr + n, sizeof(def->attrsgr) - n, "%s4", n ? ";" : "");
+    }
+    if (def->attrs & NCONIO_REVERSE)
+    {
+        n += snprintf(def->attrsgr + n, sizeof(def->attrsgr) - n, "%s7", n ? ";" : "");
+    }
+}
+
+// Rebuild the hash table with room for twice as many styles
+static int __nconio_growstyles(void)
+{
+    int cap = __nconio_stylecap ? __nconio_stylecap * 2 : 64;
+    __nconio_styledef *styles = (__nconio_styledef *)realloc(__nconio_styles, (size_t)cap * sizeof(__nconio_styledef));
+    int *hash = (int *)malloc((size_t)cap * 2 * sizeof(int));
+    if (styles == NULL || hash == NULL)
+    {
+        if (styles)
+        {
+            __nconio_styles = styles;
+        }
+        free(hash);
+        return 0;
+    }
+
+    __nconio_styles = styles;
+    __nconio_stylecap = cap;
+    free(__nconio_stylehash);
+    __nconio_stylehash = hash;
+    __nconio_stylehashcap = cap * 2;
+    for (int i = 0; i < __nconio_stylehashcap; i++)
+    {
+        __nconio_stylehash[i] = -1;
+    }
+    for (int i = 0; i < __nconio_stylecount; i++)
+    {
+        const __nconio_styledef *def = &__nconio_styles[i];
+        unsigned int slot = __nconio_stylehashof(def->fg, def->bg, def->attrs) & (__nconio_stylehashcap - 1);
+        while (__nconio_stylehash[slot] >= 0)
+        {
+            slot = (slot + 1) & (__nconio_stylehashcap - 1);
+        }
+        __nconio_stylehash[slot] = i;
+    }
+    return 1;
+}
+
+static nconio_style __nconio_internstyle(int fg, int bg, int attrs)
+{
+    if (!__nconio_validcolor(fg))
+    {
+        fg = NCONIO_WHITE;
+    }
+    if (!__nconio_validcolor(bg))
+    {
+        bg = NCONIO_BLACK;
+    }
+    attrs &= NCONIO_BOLD | NCONIO_UNDERLINE | NCONIO_REVERSE;
+
+    if (__nconio_stylehashcap)
+    {
+        unsigned int slot = __nconio_stylehashof(fg, bg, attrs) & (__nconio_stylehashcap - 1);
+        while (__nconio_stylehash[slot] >= 0)
+        {
+            const __nconio_styledef *def = &__nconio_styles[__nconio_stylehash[slot]];
+            if (def->fg == fg && def->bg == bg && def->attrs == attrs)
+            {
+                return __nconio_stylehash[slot];
+            }
+            slot = (slot + 1) & (__nconio_stylehashcap - 1);
+        }
+    }
+
+    // Not interned yet, keep the hash table at most half full.
+    // Cells store handles in 16 bits, so that is how many styles there can be.
+    if (__nconio_stylecount > 0xffff || (__nconio_stylecount >= __nconio_stylecap && !__nconio_growstyles()))
+    {
+        return 0; // Fall back to the default style
+    }
+
+    nconio_style style = __nconio_stylecount++;
+    __nconio_styledef *def = &__nconio_styles[style];
+    def->fg = fg;
+    def->bg = bg;
+    def->attrs = attrs;
+    __nconio_renderstyle(def);
+
+    unsigned int slot = __nconio_stylehashof(fg, bg, attrs) & (__nconio_stylehashcap - 1);
+    while (__nconio_stylehash[slot] >= 0)
+    {
+        slot = (slot + 1) & (__nconio_stylehashcap - 1);
+    }
+    __nconio_stylehash[slot] = style;
+    return style;
+}
+
+nconio_style nconio_makestyle(int fg, int bg, int attrs)
+{
+    __nconio_rt_lock(); // The render thread reads the table while it draws
+    nconio_style style = __nconio_internstyle(fg, bg, attrs);
+    __nconio_rt_unlock();
+    return style;
+}
+
+// Style handle for an NCONIO_ATTR value
+static nconio_style __nconio_attrtostyle(unsigned char attr)
+{
+    if (__nconio_attrstyle[attr] < 0)
+    {
+        __nconio_attrstyle[attr] = nconio_makestyle(attr & 0x0f, attr >> 4, 0);
+    }
+    return __nconio_attrstyle[attr];
+}
+
+// Start over with only the default style (white on black), which gets handle 0
+static void __nconio_resetstyles(void)
+{
+    __nconio_stylecount = 0;
+    for (int i = 0; i < __nconio_stylehashcap; i++)
+    {
+        __nconio_stylehash[i] = -1;
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        __nconio_attrstyle[i] = -1;
+    }
+    __nconio_style = nconio_makestyle(NCONIO_WHITE, NCONIO_BLACK, 0);
+}
+
+static void __nconio_freestyles(void)
+{
+    free(__nconio_styles);
+    free(__nconio_stylehash);
+    __nconio_styles = NULL;
+    __nconio_stylehash = NULL;
+    __nconio_stylecount = 0;
+    __nconio_stylecap = 0;
+    __nconio_stylehashcap = 0;
+}
+
+void nconio_setstyle(nconio_style style)
+{
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_SETSTYLE, style, 0, 0, 0, NULL, 0);
+        return;
+    }
+    if (style >= 0 && style < __nconio_stylecount)
+    {
+        __nconio_style = style;
+    }
+}
+
+nconio_style nconio_getstyle(void)
+{
+    __nconio_rt_lock();
+    nconio_style style = __nconio_style;
+    __nconio_rt_unlock();
+    return style;
+}
+
+// Change only the foreground (or background) of the current style
+static void __nconio_setcolors(int fg, int bg)
+{
+    __nconio_style = nconio_makestyle(fg, bg, __nconio_styles[__nconio_style].attrs);
+}
+
+// ##################################################################
+//    Common: Unicode
+// ##################################################################
+
+// Cells hold Unicode code points. Bytes of 0x80 or more put with the char
+// functions are kept as U+DC80 to U+DCFF, unpaired surrogates that are no
+// character, so they come back unchanged. The right half of a wide character
+// holds __NCONIO_WIDETAIL.
+#define __NCONIO_BYTECP(ch) ((unsigned short)((unsigned char)(ch) < 0x80 ? (unsigned char)(ch) : 0xDC00u + (unsigned char)(ch)))
+#define __NCONIO_ISBYTE(cp) ((cp) >= 0xDC80u && (cp) <= 0xDCFFu)
+#define __NCONIO_WIDETAIL 0xD800u
+
+// A cell stores a code point in 16 bits, its glyph. Code points above U+FFFF
+// are numbered in the order they are first drawn and stored as the surrogates
+// U+D801 to U+DC7F, the ones not taken above. Once all are taken, the glyphs
+// no cell holds any more are freed (see __nconio_sweepglyphs).
+#define __NCONIO_ASTRALFIRST 0xD801u
+#define __NCONIO_ASTRALMAX 0x47F // How many code points above U+FFFF can be held by cells at once
+#define __NCONIO_ASTRALHASH 2048 // Slots of the table that finds their glyphs, a power of two
+#define __NCONIO_ASTRALWAIT 64   // Code points drawn as U+FFFD after a sweep that freed nothing, before the next
+
+static unsigned int __nconio_astral[__NCONIO_ASTRALMAX]; // Code point of each glyph from U+D801 on, 0 if it is free
+static int __nconio_astralcount = 0;                     // Glyphs handed out before any was freed
+static unsigned short __nconio_astralhash[__NCONIO_ASTRALHASH]; // Glyph, 0 if the slot is empty
+static unsigned short __nconio_astralfree[__NCONIO_ASTRALMAX];  // Glyphs the last sweep freed
+static int __nconio_astralfreecount = 0;
+static int __nconio_astralwait = 0;
+
+// Implemented with the surfaces: free the glyphs no cell holds any more
+static int __nconio_sweepglyphs(void);
+
+// Forget the code points above U+FFFF, when no cell holds their glyphs any more
+static void __nconio_resetglyphs(void)
+{
+    __nconio_astralcount = 0;
+    __nconio_astralfreecount = 0;
+    __nconio_astralwait = 0;
+    memset(__nconio_astralhash, 0, sizeof(__nconio_astralhash));
+}
+
+// The slot of the hash table where a code point above U+FFFF is, or would go
+static unsigned int __nconio_astralslot(unsigned int cp)
+{
+    unsigned int slot = (cp * 2654435761u) & (__NCONIO_ASTRALHASH - 1);
+    while (__nconio_astralhash[slot] != 0 && __nconio_astral[__nconio_astralhash[slot] - __NCONIO_ASTRALFIRST] != cp)
+    {
+        slot = (slot + 1) & (__NCONIO_ASTRALHASH - 1);
+    }
+    return slot;
+}
+
+// The glyph that stores a code point. Above U+FFFF, when all glyphs are held
+// by cells, the code point is drawn as U+FFFD.
+static unsigned short __nconio_glyph(unsigned int cp)
+{
+    if (cp <= 0xffff)
+    {
+        return (unsigned short)cp;
+    }
+
+    unsigned int slot = __nconio_astralslot(cp);
+    if (__nconio_astralhash[slot] != 0)
+    {
+        return __nconio_astralhash[slot];
+    }
+
+    unsigned short glyph;
+    if (__nconio_astralcount < __NCONIO_ASTRALMAX)
+    {
+        glyph = (unsigned short)(__NCONIO_ASTRALFIRST + __nconio_astralcount++);
+    }
+    else
+    {
+        if (__nconio_astralfreecount == 0)
+        {
+            if (__nconio_astralwait > 0)
+            {
+                __nconio_astralwait--;
+                return 0xfffd;
+            }
+            if (__nconio_sweepglyphs() == 0)
+            {
+                __nconio_astralwait = __NCONIO_ASTRALWAIT; // Sweeping scans the whole screen, not on every call
+                return 0xfffd;
+            }
+            slot = __nconio_astralslot(cp); // The sweep rebuilt the table
+        }
+        glyph = __nconio_astralfree[--__nconio_astralfreecount];
+    }
+    __nconio_astral[glyph - __NCONIO_ASTRALFIRST] = cp;
+    __nconio_astralhash[slot] = glyph;
+    return glyph;
+}
+
+// The code point a glyph stores
+static unsigned int __nconio_glyphcp(unsigned short glyph)
+{
+    if (glyph >= __NCONIO_ASTRALFIRST && glyph < __NCONIO_ASTRALFIRST + __nconio_astralcount)
+    {
+        return __nconio_astral[glyph - __NCONIO_ASTRALFIRST];
+    }
+    return glyph;
+}
+
+typedef struct __nconio_cprange
+{
+    unsigned int first, last;
+} __nconio_cprange;
+
+// East Asian Width W and F of Unicode 14, and the CJK ideograph planes.
+// Gaps of unassigned code points are merged.
+static const __nconio_cprange __nconio_widecps[] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0}, {0x23F3, 0x23F3},
+    {0x25FD, 0x25FE}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+    {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA},
+    {0x26F2, 0x26F3}, {0x26F5, 0x26F5}, {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+    {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+    {0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x303E},
+    {0x3041, 0x3247}, {0x3250, 0x4DBF}, {0x4E00, 0xA4C6}, {0xA960, 0xA97C}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF},
+    {0xFE10, 0xFE19}, {0xFE30, 0xFE6B}, {0xFF01, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x1B2FB}, {0x1F004, 0x1F004},
+    {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F320}, {0x1F32D, 0x1F335},
+    {0x1F337, 0x1F37C}, {0x1F37E, 0x1F393}, {0x1F3A0, 0x1F3CA}, {0x1F3CF, 0x1F3D3}, {0x1F3E0, 0x1F3F0},
+    {0x1F3F4, 0x1F3F4}, {0x1F3F8, 0x1F43E}, {0x1F440, 0x1F440}, {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D},
+    {0x1F54B, 0x1F54E}, {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A}, {0x1F595, 0x1F596}, {0x1F5A4, 0x1F5A4},
+    {0x1F5FB, 0x1F64F}, {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2}, {0x1F6D5, 0x1F6DF},
+    {0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC}, {0x1F7E0, 0x1F7F0}, {0x1F90C, 0x1F93A}, {0x1F93C, 0x1F945},
+    {0x1F947, 0x1F9FF}, {0x1FA70, 0x1FAF6}, {0x20000, 0x3FFFD},
+};
+
+// Combining marks and format characters (Mn, Me, Cf), Hangul medial vowels and
+// final consonants, zero width space
+static const __nconio_cprange __nconio_zerocps[] = {
+    {0x300, 0x36F}, {0x483, 0x489}, {0x591, 0x5BD}, {0x5BF, 0x5BF}, {0x5C1, 0x5C2}, {0x5C4, 0x5C5}, {0x5C7, 0x5C7},
+    {0x600, 0x605}, {0x610, 0x61A}, {0x61C, 0x61C}, {0x64B, 0x65F}, {0x670, 0x670}, {0x6D6, 0x6DD}, {0x6DF, 0x6E4},
+    {0x6E7, 0x6E8}, {0x6EA, 0x6ED}, {0x70F, 0x70F}, {0x711, 0x711}, {0x730, 0x74A}, {0x7A6, 0x7B0}, {0x7EB, 0x7F3},
+    {0x7FD, 0x7FD}, {0x816, 0x819}, {0x81B, 0x823}, {0x825, 0x827}, {0x829, 0x82D}, {0x859, 0x85B}, {0x890, 0x89F},
+    {0x8CA, 0x902}, {0x93A, 0x93A}, {0x93C, 0x93C}, {0x941, 0x948}, {0x94D, 0x94D}, {0x951, 0x957}, {0x962, 0x963},
+    {0x981, 0x981}, {0x9BC, 0x9BC}, {0x9C1, 0x9C4}, {0x9CD, 0x9CD}, {0x9E2, 0x9E3}, {0x9FE, 0xA02}, {0xA3C, 0xA3C},
+    {0xA41, 0xA51}, {0xA70, 0xA71}, {0xA75, 0xA75}, {0xA81, 0xA82}, {0xABC, 0xABC}, {0xAC1, 0xAC8}, {0xACD, 0xACD},
+    {0xAE2, 0xAE3}, {0xAFA, 0xB01}, {0xB3C, 0xB3C}, {0xB3F, 0xB3F}, {0xB41, 0xB44}, {0xB4D, 0xB56}, {0xB62, 0xB63},
+    {0xB82, 0xB82}, {0xBC0, 0xBC0}, {0xBCD, 0xBCD}, {0xC00, 0xC00}, {0xC04, 0xC04}, {0xC3C, 0xC3C}, {0xC3E, 0xC40},
+    {0xC46, 0xC56}, {0xC62, 0xC63}, {0xC81, 0xC81}, {0xCBC, 0xCBC}, {0xCBF, 0xCBF}, {0xCC6, 0xCC6}, {0xCCC, 0xCCD},
+    {0xCE2, 0xCE3}, {0xD00, 0xD01}, {0xD3B, 0xD3C}, {0xD41, 0xD44}, {0xD4D, 0xD4D}, {0xD62, 0xD63}, {0xD81, 0xD81},
+    {0xDCA, 0xDCA}, {0xDD2, 0xDD6}, {0xE31, 0xE31}, {0xE34, 0xE3A}, {0xE47, 0xE4E}, {0xEB1, 0xEB1}, {0xEB4, 0xEBC},
+    {0xEC8, 0xECD}, {0xF18, 0xF19}, {0xF35, 0xF35}, {0xF37, 0xF37}, {0xF39, 0xF39}, {0xF71, 0xF7E}, {0xF80, 0xF84},
+    {0xF86, 0xF87}, {0xF8D, 0xFBC}, {0xFC6, 0xFC6}, {0x102D, 0x1030}, {0x1032, 0x1037}, {0x1039, 0x103A},
+    {0x103D, 0x103E}, {0x1058, 0x1059}, {0x105E, 0x1060}, {0x1071, 0x1074}, {0x1082, 0x1082}, {0x1085, 0x1086},
+    {0x108D, 0x108D}, {0x109D, 0x109D}, {0x1160, 0x11FF}, {0x135D, 0x135F}, {0x1712, 0x1714}, {0x1732, 0x1733},
+    {0x1752, 0x1753}, {0x1772, 0x1773}, {0x17B4, 0x17B5}, {0x17B7, 0x17BD}, {0x17C6, 0x17C6}, {0x17C9, 0x17D3},
+    {0x17DD, 0x17DD}, {0x180B, 0x180F}, {0x1885, 0x1886}, {0x18A9, 0x18A9}, {0x1920, 0x1922}, {0x1927, 0x1928},
+    {0x1932, 0x1932}, {0x1939, 0x193B}, {0x1A17, 0x1A18}, {0x1A1B, 0x1A1B}, {0x1A56, 0x1A56}, {0x1A58, 0x1A60},
+    {0x1A62, 0x1A62}, {0x1A65, 0x1A6C}, {0x1A73, 0x1A7F}, {0x1AB0, 0x1B03}, {0x1B34, 0x1B34}, {0x1B36, 0x1B3A},
+    {0x1B3C, 0x1B3C}, {0x1B42, 0x1B42}, {0x1B6B, 0x1B73}, {0x1B80, 0x1B81}, {0x1BA2, 0x1BA5}, {0x1BA8, 0x1BA9},
+    {0x1BAB, 0x1BAD}, {0x1BE6, 0x1BE6}, {0x1BE8, 0x1BE9}, {0x1BED, 0x1BED}, {0x1BEF, 0x1BF1}, {0x1C2C, 0x1C33},
+    {0x1C36, 0x1C37}, {0x1CD0, 0x1CD2}, {0x1CD4, 0x1CE0}, {0x1CE2, 0x1CE8}, {0x1CED, 0x1CED}, {0x1CF4, 0x1CF4},
+    {0x1CF8, 0x1CF9}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x206F}, {0x20D0, 0x20F0},
+    {0x2CEF, 0x2CF1}, {0x2D7F, 0x2D7F}, {0x2DE0, 0x2DFF}, {0x302A, 0x302D}, {0x3099, 0x309A}, {0xA66F, 0xA672},
+    {0xA674, 0xA67D}, {0xA69E, 0xA69F}, {0xA6F0, 0xA6F1}, {0xA802, 0xA802}, {0xA806, 0xA806}, {0xA80B, 0xA80B},
+    {0xA825, 0xA826}, {0xA82C, 0xA82C}, {0xA8C4, 0xA8C5}, {0xA8E0, 0xA8F1}, {0xA8FF, 0xA8FF}, {0xA926, 0xA92D},
+    {0xA947, 0xA951}, {0xA980, 0xA982}, {0xA9B3, 0xA9B3}, {0xA9B6, 0xA9B9}, {0xA9BC, 0xA9BD}, {0xA9E5, 0xA9E5},
+    {0xAA29, 0xAA2E}, {0xAA31, 0xAA32}, {0xAA35, 0xAA36}, {0xAA43, 0xAA43}, {0xAA4C, 0xAA4C}, {0xAA7C, 0xAA7C},
+    {0xAAB0, 0xAAB0}, {0xAAB2, 0xAAB4}, {0xAAB7, 0xAAB8}, {0xAABE, 0xAABF}, {0xAAC1, 0xAAC1}, {0xAAEC, 0xAAED},
+    {0xAAF6, 0xAAF6}, {0xABE5, 0xABE5}, {0xABE8, 0xABE8}, {0xABED, 0xABED}, {0xFB1E, 0xFB1E}, {0xFE00, 0xFE0F},
+    {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0xFFF9, 0xFFFB}, {0x101FD, 0x101FD}, {0x102E0, 0x102E0}, {0x10376, 0x1037A},
+    {0x10A01, 0x10A0F}, {0x10A38, 0x10A3F}, {0x10AE5, 0x10AE6}, {0x10D24, 0x10D27}, {0x10EAB, 0x10EAC},
+    {0x10F46, 0x10F50}, {0x10F82, 0x10F85}, {0x11001, 0x11001}, {0x11038, 0x11046}, {0x11070, 0x11070},
+    {0x11073, 0x11074}, {0x1107F, 0x11081}, {0x110B3, 0x110B6}, {0x110B9, 0x110BA}, {0x110BD, 0x110BD},
+    {0x110C2, 0x110CD}, {0x11100, 0x11102}, {0x11127, 0x1112B}, {0x1112D, 0x11134}, {0x11173, 0x11173},
+    {0x11180, 0x11181}, {0x111B6, 0x111BE}, {0x111C9, 0x111CC}, {0x111CF, 0x111CF}, {0x1122F, 0x11231},
+    {0x11234, 0x11234}, {0x11236, 0x11237}, {0x1123E, 0x1123E}, {0x112DF, 0x112DF}, {0x112E3, 0x112EA},
+    {0x11300, 0x11301}, {0x1133B, 0x1133C}, {0x11340, 0x11340}, {0x11366, 0x11374}, {0x11438, 0x1143F},
+    {0x11442, 0x11444}, {0x11446, 0x11446}, {0x1145E, 0x1145E}, {0x114B3, 0x114B8}, {0x114BA, 0x114BA},
+    {0x114BF, 0x114C0}, {0x114C2, 0x114C3}, {0x115B2, 0x115B5}, {0x115BC, 0x115BD}, {0x115BF, 0x115C0},
+    {0x115DC, 0x115DD}, {0x11633, 0x1163A}, {0x1163D, 0x1163D}, {0x1163F, 0x11640}, {0x116AB, 0x116AB},
+    {0x116AD, 0x116AD}, {0x116B0, 0x116B5}, {0x116B7, 0x116B7}, {0x1171D, 0x1171F}, {0x11722, 0x11725},
+    {0x11727, 0x1172B}, {0x1182F, 0x11837}, {0x11839, 0x1183A}, {0x1193B, 0x1193C}, {0x1193E, 0x1193E},
+    {0x11943, 0x11943}, {0x119D4, 0x119DB}, {0x119E0, 0x119E0}, {0x11A01, 0x11A0A}, {0x11A33, 0x11A38},
+    {0x11A3B, 0x11A3E}, {0x11A47, 0x11A47}, {0x11A51, 0x11A56}, {0x11A59, 0x11A5B}, {0x11A8A, 0x11A96},
+    {0x11A98, 0x11A99}, {0x11C30, 0x11C3D}, {0x11C3F, 0x11C3F}, {0x11C92, 0x11CA7}, {0x11CAA, 0x11CB0},
+    {0x11CB2, 0x11CB3}, {0x11CB5, 0x11CB6}, {0x11D31, 0x11D45}, {0x11D47, 0x11D47}, {0x11D90, 0x11D91},
+    {0x11D95, 0x11D95}, {0x11D97, 0x11D97}, {0x11EF3, 0x11EF4}, {0x13430, 0x13438}, {0x16AF0, 0x16AF4},
+    {0x16B30, 0x16B36}, {0x16F4F, 0x16F4F}, {0x16F8F, 0x16F92}, {0x16FE4, 0x16FE4}, {0x1BC9D, 0x1BC9E},
+    {0x1BCA0, 0x1CF46}, {0x1D167, 0x1D169}, {0x1D173, 0x1D182}, {0x1D185, 0x1D18B}, {0x1D1AA, 0x1D1AD},
+    {0x1D242, 0x1D244}, {0x1DA00, 0x1DA36}, {0x1DA3B, 0x1DA6C}, {0x1DA75, 0x1DA75}, {0x1DA84, 0x1DA84},
+    {0x1DA9B, 0x1DAAF}, {0x1E000, 0x1E02A}, {0x1E130, 0x1E136}, {0x1E2AE, 0x1E2AE}, {0x1E2EC, 0x1E2EF},
+    {0x1E8D0, 0x1E8D6}, {0x1E944, 0x1E94A}, {0xE0001, 0xE01EF},
+};
+
+static int __nconio_incprange(unsigned int cp, const __nconio_cprange *ranges, int count)
+{
+    int lo = 0, hi = count - 1;
+
+    if (cp < ranges[0].first || cp > ranges[hi].last)
+    {
+        return 0;
+    }
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (cp > ranges[mid].last)
+        {
+            lo = mid + 1;
+        }
+        else if (cp < ranges[mid].first)
+        {
+            hi = mid - 1;
+        }
+        else
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int nconio_cpwidth(unsigned int cp)
+{
+    if (cp < 0x300)
+    {
+        return cp >= 0x20 && (cp < 0x7f || cp >= 0xa0); // No wide or combining characters before U+0300
+    }
+    if (cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+    {
+        return 0;
+    }
+    if (__nconio_incprange(cp, __nconio_zerocps, (int)(sizeof(__nconio_zerocps) / sizeof(__nconio_zerocps[0]))))
+    {
+        return 0;
+    }
+    return __nconio_incprange(cp, __nconio_widecps, (int)(sizeof(__nconio_widecps) / sizeof(__nconio_widecps[0]))) ? 2 : 1;
+}
+
+// Decode the UTF-8 sequence at s, at most n bytes, into *cp. Returns the bytes
+// it takes, or 0 if the n bytes are the valid start of a longer sequence. An
+// invalid sequence takes one byte and decodes to U+FFFD.
+static int __nconio_utf8decode(const char *s, int n, unsigned int *cp)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    int len;
+    unsigned int min;
+
+    if (u[0] < 0x80)
+    {
+        *cp = u[0];
+        return 1;
+    }
+    if (u[0] >= 0xc2 && u[0] <= 0xdf)
+    {
+        len = 2;
+        min = 0x80;
+        *cp = u[0] & 0x1f;
+    }
+    else if (u[0] >= 0xe0 && u[0] <= 0xef)
+    {
+        len = 3;
+        min = 0x800;
+        *cp = u[0] & 0x0f;
+    }
+    else if (u[0] >= 0xf0 && u[0] <= 0xf4)
+    {
+        len = 4;
+        min = 0x10000;
+        *cp = u[0] & 0x07;
+    }
+    else
+    {
+        *cp = 0xfffd;
+        return 1;
+    }
+
+    for (int i = 1; i < len; i++)
+    {
+        if (i >= n)
+        {
+            return 0;
+        }
+        if ((u[i] & 0xc0) != 0x80)
+        {
+            *cp = 0xfffd;
+            return 1;
+        }
+        *cp = (*cp << 6) | (u[i] & 0x3f);
+    }
+    if (*cp < min || *cp > 0x10ffff || (*cp >= 0xd800 && *cp <= 0xdfff))
+    {
+        *cp = 0xfffd; // Overlong, too large or a surrogate
+        return 1;
+    }
+    return len;
+}
+
+// ##################################################################
+//    Common: screen model
+// ##################################################################
+
+// One character cell of the screen, 32 bits
+typedef struct __nconio_cell
+{
+    unsigned short ch;    // Glyph of the code point (see __nconio_glyph, __NCONIO_BYTECP and __NCONIO_WIDETAIL)
+    unsigned short style; // Colors and attributes (see nconio_style)
+} __nconio_cell;
+
+// All buffers of the screen are carved from one block, allocated when the
+// screen gets its size. Drawing and flushing allocate nothing.
+static void *__nconio_arena = NULL;
+static __nconio_cell *__nconio_back = NULL;     // What has been drawn
+static __nconio_cell *__nconio_front = NULL;    // What the terminal shows
+static __nconio_cell *__nconio_base = NULL;     // What was drawn on the screen itself, under the surfaces (see __nconio_getbase)
+static __nconio_cell *__nconio_baseroom = NULL; // Where __nconio_base goes once there are surfaces
+static __nconio_cell *__nconio_composed = NULL; // One row of composited cells
+static unsigned int *__nconio_rowhashes = NULL; // Two per row, for the backend to compare rows
+static int *__nconio_rowstart = NULL;           // First cell of each row that differs, for the backend
+static unsigned char *__nconio_rowstale = NULL; // The front row changed since its hash was taken
+static int __nconio_w = 0;                      // Size of the buffers in cells
+static int __nconio_h = 0;
+static int __nconio_x = 0; // Cursor position
+static int __nconio_y = 0;
+static int __nconio_cleared = 0;         // The terminal has to be cleared before the next diff
+static __nconio_cell __nconio_clearcell; // Cell the terminal is cleared with
+
+// Defined with the surfaces: keep what was drawn on an area of the screen
+// and have the surfaces composited over it again
+static void __nconio_screendirty(int x, int y, int w, int h);
+static void __nconio_adddirty(int x, int y, int w, int h);
+
+static void __nconio_fillcells(__nconio_cell *cells, size_t count, __nconio_cell cell)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        cells[i] = cell;
+    }
+}
+
+// Cells x0 to x1 - 1 of a row of w cells are about to be written. A wide
+// character they would cut in half becomes a blank, and x0 and x1 are
+// widened to the cells that changed.
+static void __nconio_splitwide(__nconio_cell *row, int w, int *x0, int *x1)
+{
+    if (*x0 > 0 && *x0 < w && row[*x0].ch == __NCONIO_WIDETAIL)
+    {
+        row[*x0 - 1].ch = ' ';
+        (*x0)--;
+    }
+    if (*x1 > 0 && *x1 < w && row[*x1].ch == __NCONIO_WIDETAIL)
+    {
+        row[*x1].ch = ' ';
+        (*x1)++;
+    }
+}
+
+// Copy count cells into a row of w cells at x, clipped to the row. Wide
+// characters cut in half by the clipping or by the new cells become blanks.
+// Sets x0 and x1 to the cells that changed, x0 >= x1 if none did.
+static void __nconio_writecells(__nconio_cell *row, int w, const __nconio_cell *cells, int count, int x, int *x0, int *x1)
+{
+    int n;
+
+    if (x < 0)
+    {
+        cells -= x;
+        count += x;
+        x = 0;
+    }
+    n = count < w - x ? count : w - x;
+    *x0 = x;
+    *x1 = x + n;
+    if (n <= 0)
+    {
+        return;
+    }
+
+    __nconio_splitwide(row, w, x0, x1);
+    memcpy(row + x, cells, (size_t)n * sizeof(__nconio_cell));
+    if (row[x].ch == __NCONIO_WIDETAIL)
+    {
+        row[x].ch = ' '; // Its left half was clipped
+    }
+    if (n < count && cells[n].ch == __NCONIO_WIDETAIL)
+    {
+        row[x + n - 1].ch = ' '; // Its right half was clipped
+    }
+}
+
+// Allocate the block for a screen of w x h cells: the back, front and base
+// buffers, the composited row and the tables per row, 12 bytes per cell and
+// a few per row in all. Returns the block with the buffers in the order they
+// are listed, or NULL.
+static void *__nconio_newarena(int w, int h)
+{
+    size_t count = (size_t)w * h;
+    return malloc((3 * count + (size_t)w) * sizeof(__nconio_cell) + 2 * (size_t)h * sizeof(unsigned int) + (size_t)h * (sizeof(int) + 1));
+}
+
+// Free the old block and use the buffers in the new one, of a w x h screen.
+// The base buffer is only in use if there are surfaces. NULL frees the screen.
+static void __nconio_usearena(void *arena, int w, int h, int hasbase)
+{
+    size_t count = (size_t)w * h;
+
+    free(__nconio_arena);
+    __nconio_arena = arena;
+    if (arena == NULL)
+    {
+        __nconio_back = __nconio_front = __nconio_base = __nconio_baseroom = __nconio_composed = NULL;
+        __nconio_rowhashes = NULL;
+        __nconio_rowstart = NULL;
+        __nconio_rowstale = NULL;
+        __nconio_w = 0;
+        __nconio_h = 0;
+        return;
+    }
+    __nconio_back = (__nconio_cell *)arena;
+    __nconio_front = __nconio_back + count;
+    __nconio_baseroom = __nconio_front + count;
+    __nconio_base = hasbase ? __nconio_baseroom : NULL;
+    __nconio_composed = __nconio_baseroom + count;
+    __nconio_rowhashes = (unsigned int *)(__nconio_composed + w);
+    __nconio_rowstart = (int *)(__nconio_rowhashes + 2 * (size_t)h);
+    __nconio_rowstale = (unsigned char *)(__nconio_rowstart + h);
+    memset(__nconio_rowstale, 1, (size_t)h); // No front row was hashed yet
+    __nconio_w = w;
+    __nconio_h = h;
+}
+
+// Allocate the buffers for a screen of w x h cells. The screen starts out
+// blank and is cleared on the terminal with the next flush.
+static int __nconio_allocscreen(int w, int h)
+{
+    size_t count = (size_t)w * h;
+    __nconio_cell blank = {' ', 0};
+    void *arena = __nconio_newarena(w, h);
+
+    if (arena == NULL)
+    {
+        __nconio_usearena(NULL, 0, 0, 0);
+        return 0;
+    }
+
+    __nconio_usearena(arena, w, h, 0); // The base is copied from the back buffer when it is needed
+    __nconio_fillcells(__nconio_back, count, blank);
+    __nconio_fillcells(__nconio_front, count, blank);
+    __nconio_clearcell = blank;
+    __nconio_cleared = 1;
+    if (__nconio_x >= w || __nconio_y >= h)
+    {
+        __nconio_x = 0;
+        __nconio_y = 0;
+    }
+    return 1;
+}
+
+// Resize both buffers to w x h cells, keeping the cells the old and the new
+// size have in common. Cells that come into view are blank in the back buffer
+// and unknown in the front buffer, so the next flush paints just those.
+static int __nconio_resizescreen(int w, int h)
+{
+    size_t count = (size_t)w * h;
+    int keepw = w < __nconio_w ? w : __nconio_w;
+    int keeph = h < __nconio_h ? h : __nconio_h;
+    __nconio_cell unknown = __nconio_clearcell;
+
+    if (w == __nconio_w && h == __nconio_h)
+    {
+        return 0;
+    }
+
+    void *arena = __nconio_newarena(w, h);
+    if (arena == NULL)
+    {
+        return 0;
+    }
+    __nconio_cell *back = (__nconio_cell *)arena;
+    __nconio_cell *front = back + count;
+    __nconio_cell *base = __nconio_base ? front + count : NULL;
+
+    unknown.ch ^= 1; // Differs from every blank
+    __nconio_fillcells(back, count, __nconio_clearcell);
+    __nconio_fillcells(front, count, unknown);
+    if (base)
+    {
+        __nconio_fillcells(base, count, __nconio_clearcell);
+    }
+    for (int y = 0; y < keeph; y++)
+    {
+        memcpy(back + (size_t)y * w, __nconio_back + (size_t)y * __nconio_w, (size_t)keepw * sizeof(__nconio_cell));
+        memcpy(front + (size_t)y * w, __nconio_front + (size_t)y * __nconio_w, (size_t)keepw * sizeof(__nconio_cell));
+        if (base)
+        {
+            memcpy(base + (size_t)y * w, __nconio_base + (size_t)y * __nconio_w, (size_t)keepw * sizeof(__nconio_cell));
+        }
+    }
+
+    __nconio_usearena(arena, w, h, base != NULL);
+    if (__nconio_x >= w || __nconio_y >= h)
+    {
+        __nconio_x = 0;
+        __nconio_y = 0;
+    }
+    if (__nconio_base)
+    {
+        __nconio_adddirty(0, 0, w, h); // Surfaces may reach into the new cells
+    }
+    return 1;
+}
+
+static void __nconio_freescreen(void)
+{
+    __nconio_usearena(NULL, 0, 0, 0);
+}
+
+// Draw a character with the current colors into the back buffer
+static void __nconio_setcell(int x, int y, char ch)
+{
+    if (x < 0 || y < 0 || x >= __nconio_w || y >= __nconio_h)
+    {
+        return;
+    }
+
+    __nconio_cell *row = &__nconio_back[y * __nconio_w];
+    int x0 = x, x1 = x + 1;
+    __nconio_splitwide(row, __nconio_w, &x0, &x1);
+    row[x].ch = __NCONIO_BYTECP(ch);
+    row[x].style = (unsigned short)__nconio_style;
+    __nconio_screendirty(x0, y, x1 - x0, 1);
+}
+
+// Copy a row of characters (and NCONIO_ATTR attributes, or the current
+// colors if attrs is NULL) into the back buffer, clipped to the screen
+static void __nconio_blitrow(const char *chars, const unsigned char *attrs, int count, int x, int y)
+{
+    if (y < 0 || y >= __nconio_h)
+    {
+        return;
+    }
+    if (x < 0)
+    {
+        chars -= x;
+        attrs = attrs ? attrs - x : NULL;
+        count += x;
+        x = 0;
+    }
+    if (count > __nconio_w - x)
+    {
+        count = __nconio_w - x;
+    }
+    if (count <= 0)
+    {
+        return;
+    }
+
+    int x0 = x, x1 = x + count;
+    __nconio_splitwide(&__nconio_back[y * __nconio_w], __nconio_w, &x0, &x1);
+    __nconio_cell *cell = &__nconio_back[y * __nconio_w + x];
+    if (attrs)
+    {
+        for (int i = 0; i < count; i++, cell++)
+        {
+            cell->ch = __NCONIO_BYTECP(chars[i]);
+            cell->style = (unsigned short)__nconio_attrtostyle(attrs[i]);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < count; i++, cell++)
+        {
+            cell->ch = __NCONIO_BYTECP(chars[i]);
+            cell->style = (unsigned short)__nconio_style;
+        }
+    }
+    __nconio_screendirty(x0, y, x1 - x0, 1);
+}
+
+// Blank the back buffer with the current colors and have the terminal
+// cleared before the next diff. Terminals clear without attributes, so
+// the blanks only take the colors of the current style.
+static void __nconio_clearscreen(void)
+{
+    const __nconio_styledef *def = &__nconio_styles[__nconio_style];
+    __nconio_cell blank = {' ', (unsigned short)nconio_makestyle(def->fg, def->bg, 0)};
+    __nconio_fillcells(__nconio_back, (size_t)__nconio_w * __nconio_h, blank);
+    __nconio_clearcell = blank;
+    __nconio_cleared = 1;
+    __nconio_screendirty(0, 0, __nconio_w, __nconio_h);
+}
+
+static int __nconio_celleq(const __nconio_cell *a, const __nconio_cell *b)
+{
+    return a->ch == b->ch && a->style == b->style;
+}
+
+// Skip the cells from x on, up to end, that are equal in back and front (or,
+// with equal 0, that differ). Returns the first cell that is not skipped, or end.
+static int __nconio_skipcells_scalar(const __nconio_cell *back, const __nconio_cell *front, int x, int end, int equal)
+{
+    while (x < end && __nconio_celleq(&back[x], &front[x]) == equal)
+    {
+        x++;
+    }
+    return x;
+}
+
+#ifdef __NCONIO_SSE2
+// The vector kernels compare a cell as one 32-bit lane
+typedef char __nconio_cellsize[sizeof(__nconio_cell) == 4 ? 1 : -1];
+
+// All ones in the lanes of the four cells at a and b that are equal
+static __m128i __nconio_celleq_sse2(const __nconio_cell *a, const __nconio_cell *b)
+{
+    return _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b));
+}
+
+// __nconio_skipcells_scalar eight cells at a time. Short runs end within the
+// first cells, which are checked one by one before any vector is loaded.
+static int __nconio_skipcells_sse2(const __nconio_cell *back, const __nconio_cell *front, int x, int end, int equal)
+{
+    int skip = equal ? 0xffff : 0; // Mask of eight cells that are all skipped
+    int first = end - x < 4 ? end : x + 4;
+
+    x = __nconio_skipcells_scalar(back, front, x, first, equal);
+    if (x < first)
+    {
+        return x;
+    }
+    for (; x + 8 <= end; x += 8)
+    {
+        __m128i lo = __nconio_celleq_sse2(back + x, front + x);
+        __m128i hi = __nconio_celleq_sse2(back + x + 4, front + x + 4);
+        if (_mm_movemask_epi8(equal ? _mm_and_si128(lo, hi) : _mm_or_si128(lo, hi)) != skip)
+        {
+            break;
+        }
+    }
+    return __nconio_skipcells_scalar(back, front, x, end, equal);
+}
+#endif
+
+#ifdef __NCONIO_AVX2
+__attribute__((target("avx2"))) static __m256i __nconio_celleq_avx2(const __nconio_cell *a, const __nconio_cell *b)
+{
+    return _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)a), _mm256_loadu_si256((const __m256i *)b));
+}
+
+// __nconio_skipcells_scalar sixteen cells at a time, like __nconio_skipcells_sse2
+__attribute__((target("avx2"))) static int __nconio_skipcells_avx2(const __nconio_cell *back, const __nconio_cell *front, int x, int end, int equal)
+{
+    int skip = equal ? -1 : 0; // Mask of sixteen cells that are all skipped
+    int first = end - x < 4 ? end : x + 4;
+
+    x = __nconio_skipcells_scalar(back, front, x, first, equal);
+    if (x < first)
+    {
+        return x;
+    }
+    for (; x + 16 <= end; x += 16)
+    {
+        __m256i lo = __nconio_celleq_avx2(back + x, front + x);
+        __m256i hi = __nconio_celleq_avx2(back + x + 8, front + x + 8);
+        if (_mm256_movemask_epi8(equal ? _mm256_and_si256(lo, hi) : _mm256_or_si256(lo, hi)) != skip)
+        {
+            break;
+        }
+    }
+    return __nconio_skipcells_scalar(back, front, x, end, equal);
+}
+#endif
+
+static int __nconio_skipcells(const __nconio_cell *back, const __nconio_cell *front, int x, int end, int equal)
+{
+#ifdef __NCONIO_AVX2
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return __nconio_skipcells_avx2(back, front, x, end, equal);
+    }
+#endif
+#ifdef __NCONIO_SSE2
+    return __nconio_skipcells_sse2(back, front, x, end, equal);
+#else
+    return __nconio_skipcells_scalar(back, front, x, end, equal);
+#endif
+}
+
+// Find the next run of cells in row y, at or after *x, that differ between
+// the back and the front buffer. Returns 0 if the rest of the row is clean.
+static int __nconio_nextspan(int y, int *x, int *count)
+{
+    const __nconio_cell *back = __nconio_back + (size_t)y * __nconio_w;
+    const __nconio_cell *front = __nconio_front + (size_t)y * __nconio_w;
+    int start = __nconio_skipcells(back, front, *x, __nconio_w, 1);
+
+    if (start >= __nconio_w)
+    {
+        __NCONIO_COUNT(diffed, __nconio_w - *x);
+        return 0;
+    }
+
+    int end = __nconio_skipcells(back, front, start + 1, __nconio_w, 0);
+    __NCONIO_COUNT(diffed, end - *x);
+
+    // A wide character is sent whole, both halves go into the span
+    if (start > 0 && back[start].ch == __NCONIO_WIDETAIL)
+    {
+        start--;
+    }
+    if (end < __nconio_w && back[end].ch == __NCONIO_WIDETAIL)
+    {
+        end++;
+    }
+
+    *x = start;
+    *count = end - start;
+    return 1;
+}
+
+// Mark a span as shown on the terminal
+static void __nconio_commitspan(int x, int y, int count)
+{
+    size_t offset = (size_t)y * __nconio_w + x;
+    memcpy(__nconio_front + offset, __nconio_back + offset, (size_t)count * sizeof(__nconio_cell));
+    __nconio_rowstale[y] = 1;
+    __NCONIO_COUNT(emitted, count);
+}
+
+// The terminal was cleared, so the front buffer now holds nothing but blanks
+static void __nconio_commitclear(void)
+{
+    __nconio_fillcells(__nconio_front, (size_t)__nconio_w * __nconio_h, __nconio_clearcell);
+    memset(__nconio_rowstale, 1, (size_t)__nconio_h);
+    __nconio_cleared = 0;
+}
+
+// Reading the screen never touches the terminal, it is served from the back buffer
+
+// The char that getchat reads for a code point
+static char __nconio_cpchar(unsigned int cp)
+{
+    if (cp < 0x80)
+    {
+        return (char)cp;
+    }
+    return __NCONIO_ISBYTE(cp) ? (char)(cp - 0xdc00) : '?';
+}
+
+char getchat(int x, int y)
+{
+    char ch = '\0';
+
+    __nconio_rt_lock();
+    if (x >= 0 && y >= 0 && x < __nconio_w && y < __nconio_h)
+    {
+        ch = __nconio_cpchar(__nconio_back[y * __nconio_w + x].ch);
+    }
+    __nconio_rt_unlock();
+    return ch;
+}
+
+unsigned int nconio_getcp(int x, int y)
+{
+    unsigned int cp = 0;
+
+    __nconio_rt_lock();
+    if (x >= 0 && y >= 0 && x < __nconio_w && y < __nconio_h)
+    {
+        cp = __nconio_glyphcp(__nconio_back[y * __nconio_w + x].ch);
+        cp = cp == __NCONIO_WIDETAIL ? 0 : cp;
+    }
+    __nconio_rt_unlock();
+    return cp;
+}
+
+unsigned char getattrat(int x, int y)
+{
+    unsigned char attr = 0;
+
+    __nconio_rt_lock();
+    if (x >= 0 && y >= 0 && x < __nconio_w && y < __nconio_h)
+    {
+        const __nconio_styledef *def = &__nconio_styles[__nconio_back[y * __nconio_w + x].style];
+        attr = NCONIO_ATTR(__nconio_to16(def->fg), __nconio_to16(def->bg));
+    }
+    __nconio_rt_unlock();
+    return attr;
+}
+
+void getrect(char *chars, unsigned char *attrs, int w, int h, int stride, int x, int y)
+{
+    __nconio_rt_lock();
+    for (int row = 0; row < h; row++)
+    {
+        char *rowchars = chars ? chars + (size_t)row * stride : NULL;
+        unsigned char *rowattrs = attrs ? attrs + (size_t)row * stride : NULL;
+        int sy = y + row;
+
+        // Start with everything outside, then copy the part that is on screen
+        if (rowchars)
+        {
+            memset(rowchars, 0, (size_t)w);
+        }
+        if (rowattrs)
+        {
+            memset(rowattrs, 0, (size_t)w);
+        }
+        if (sy < 0 || sy >= __nconio_h)
+        {
+            continue;
+        }
+
+        int from = x < 0 ? -x : 0;
+        int to = x + w > __nconio_w ? __nconio_w - x : w;
+        if (from >= to)
+        {
+            continue;
+        }
+
+        const __nconio_cell *cell = &__nconio_back[sy * __nconio_w + x + from];
+        for (int i = from; i < to; i++, cell++)
+        {
+            if (rowchars)
+            {
+                rowchars[i] = __nconio_cpchar(cell->ch);
+            }
+            if (rowattrs)
+            {
+                const __nconio_styledef *def = &__nconio_styles[cell->style];
+                rowattrs[i] = NCONIO_ATTR(__nconio_to16(def->fg), __nconio_to16(def->bg));
+            }
+        }
+    }
+    __nconio_rt_unlock();
+}
+
+
+// ##################################################################
+//    Common: surfaces
+// ##################################################################
+
+struct nconio_surface
+{
+    __nconio_cell *cells; // Character 0 is transparent
+    int w, h;
+    int x, y; // Position on the screen
+    int z;
+    int visible;
+};
+
+// A rectangle of the screen, x1 and y1 exclusive
+typedef struct __nconio_rect
+{
+    int x0, y0, x1, y1;
+} __nconio_rect;
+
+#define __NCONIO_MAXDIRTY 32 // Dirty rectangles kept before all are merged into one
+
+static nconio_surface **__nconio_surfaces = NULL; // Sorted by z, back to front
+static int __nconio_surfacecount = 0;
+static int __nconio_surfacecap = 0;
+static nconio_surface *__nconio_target = NULL; // Surface drawing goes to, NULL for the screen
+static __nconio_rect __nconio_dirty[__NCONIO_MAXDIRTY]; // Screen areas to composite at the next flush
+static int __nconio_dirtycount = 0;
+
+// Implemented per platform: put cells on the screen, already clipped. cells
+// may point into the back buffer at x, y.
+static void __nconio_putcells(const __nconio_cell *cells, int count, int x, int y);
+
+// Mark an area of the screen to be composited again
+static void __nconio_adddirty(int x, int y, int w, int h)
+{
+    __nconio_rect r = {x < 0 ? 0 : x, y < 0 ? 0 : y, x + w > __nconio_w ? __nconio_w : x + w, y + h > __nconio_h ? __nconio_h : y + h};
+
+    if (r.x0 >= r.x1 || r.y0 >= r.y1)
+    {
+        return;
+    }
+
+    // Grow a rectangle that overlaps or touches the new one
+    for (int i = 0; i < __nconio_dirtycount; i++)
+    {
+        __nconio_rect *d = &__nconio_dirty[i];
+        if (r.x0 <= d->x1 && d->x0 <= r.x1 && r.y0 <= d->y1 && d->y0 <= r.y1)
+        {
+            d->x0 = r.x0 < d->x0 ? r.x0 : d->x0;
+            d->y0 = r.y0 < d->y0 ? r.y0 : d->y0;
+            d->x1 = r.x1 > d->x1 ? r.x1 : d->x1;
+            d->y1 = r.y1 > d->y1 ? r.y1 : d->y1;
+            return;
+        }
+    }
+
+    if (__nconio_dirtycount == __NCONIO_MAXDIRTY)
+    {
+        // Too many scattered changes, composite their bounding box instead
+        for (int i = 0; i < __nconio_dirtycount; i++)
+        {
+            const __nconio_rect *d = &__nconio_dirty[i];
+            r.x0 = d->x0 < r.x0 ? d->x0 : r.x0;
+            r.y0 = d->y0 < r.y0 ? d->y0 : r.y0;
+            r.x1 = d->x1 > r.x1 ? d->x1 : r.x1;
+            r.y1 = d->y1 > r.y1 ? d->y1 : r.y1;
+        }
+        __nconio_dirtycount = 0;
+    }
+    __nconio_dirty[__nconio_dirtycount++] = r;
+}
+
+// The screen without the surfaces. Kept from the first surface on, until then
+// the back buffer holds nothing else.
+static __nconio_cell *__nconio_getbase(void)
+{
+    if (__nconio_base == NULL && __nconio_back != NULL)
+    {
+        __nconio_base = __nconio_baseroom;
+        memcpy(__nconio_base, __nconio_back, (size_t)__nconio_w * __nconio_h * sizeof(__nconio_cell));
+    }
+    return __nconio_base;
+}
+
+static void __nconio_screendirty(int x, int y, int w, int h)
+{
+    if (__nconio_base == NULL)
+    {
+        return;
+    }
+
+    int x0 = x < 0 ? 0 : x, y0 = y < 0 ? 0 : y;
+    int x1 = x + w > __nconio_w ? __nconio_w : x + w, y1 = y + h > __nconio_h ? __nconio_h : y + h;
+    for (int row = y0; row < y1 && x0 < x1; row++)
+    {
+        size_t offset = (size_t)row * __nconio_w + x0;
+        memcpy(__nconio_base + offset, __nconio_back + offset, (size_t)(x1 - x0) * sizeof(__nconio_cell));
+    }
+    __nconio_adddirty(x, y, w, h);
+}
+
+static void __nconio_dirtysurface(const nconio_surface *s)
+{
+    __nconio_adddirty(s->x, s->y, s->w, s->h);
+}
+
+// Draw a row into the target surface, clipped to it. Returns 0 if the screen is the target.
+static int __nconio_surfacedraw(const char *chars, const unsigned char *attrs, int count, int x, int y)
+{
+    nconio_surface *s = __nconio_target;
+
+    if (s == NULL)
+    {
+        return 0;
+    }
+    if (y < 0 || y >= s->h)
+    {
+        return 1;
+    }
+    if (x < 0)
+    {
+        chars -= x;
+        attrs = attrs ? attrs - x : NULL;
+        count += x;
+        x = 0;
+    }
+    if (count > s->w - x)
+    {
+        count = s->w - x;
+    }
+    if (count <= 0)
+    {
+        return 1;
+    }
+
+    int x0 = x, x1 = x + count;
+    __nconio_splitwide(&s->cells[y * s->w], s->w, &x0, &x1);
+    __nconio_cell *cell = &s->cells[y * s->w + x];
+    for (int i = 0; i < count; i++, cell++)
+    {
+        cell->ch = __NCONIO_BYTECP(chars[i]);
+        cell->style = (unsigned short)(attrs ? __nconio_attrtostyle(attrs[i]) : __nconio_style);
+    }
+    if (s->visible)
+    {
+        __nconio_adddirty(s->x + x0, s->y + y, x1 - x0, 1);
+    }
+    return 1;
+}
+
+// Make the target surface transparent
+static void __nconio_clearsurface(void)
+{
+    __nconio_cell clear = {0, (unsigned short)__nconio_style};
+    __nconio_fillcells(__nconio_target->cells, (size_t)__nconio_target->w * __nconio_target->h, clear);
+    if (__nconio_target->visible)
+    {
+        __nconio_dirtysurface(__nconio_target);
+    }
+}
+
+// A surface may cover one half of a wide character below it, or end in the
+// middle of one of its own. Such halves are drawn as blanks. Cells left and
+// right of the composited row are looked up in the back buffer.
+static void __nconio_fixwide(__nconio_cell *row, int count, int x, int y)
+{
+    const __nconio_cell *back = __nconio_back + (size_t)y * __nconio_w;
+
+    for (int i = 0; i < count; i++)
+    {
+        unsigned int cp = __nconio_glyphcp(row[i].ch);
+        if (cp == __NCONIO_WIDETAIL)
+        {
+            unsigned int head = __nconio_glyphcp(i > 0 ? row[i - 1].ch : (x > 0 ? back[x - 1].ch : ' '));
+            if (nconio_cpwidth(head) != 2)
+            {
+                row[i].ch = ' ';
+            }
+        }
+        else if (cp >= 0x1100 && nconio_cpwidth(cp) == 2) // No wide characters before U+1100
+        {
+            unsigned int tail = i + 1 < count ? row[i + 1].ch : (x + count < __nconio_w ? back[x + count].ch : ' ');
+            if (tail != __NCONIO_WIDETAIL)
+            {
+                row[i].ch = ' ';
+            }
+        }
+    }
+}
+
+// Composite the dirty areas into the screen. A cell shows the frontmost surface
+// that is not transparent there, or what was drawn on the screen itself.
+static void __nconio_compose(void)
+{
+    if (__nconio_dirtycount == 0 || __nconio_getbase() == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < __nconio_dirtycount; i++)
+    {
+        const __nconio_rect *r = &__nconio_dirty[i];
+        for (int y = r->y0; y < r->y1 && y < __nconio_h; y++)
+        {
+            int x1 = r->x1 < __nconio_w ? r->x1 : __nconio_w;
+            __nconio_cell *row = __nconio_composed;
+
+            if (x1 <= r->x0)
+            {
+                continue;
+            }
+
+            memcpy(row, __nconio_base + (size_t)y * __nconio_w + r->x0, (size_t)(x1 - r->x0) * sizeof(__nconio_cell));
+            for (int s = 0; s < __nconio_surfacecount; s++) // Back to front, the last opaque cell wins
+            {
+                const nconio_surface *surface = __nconio_surfaces[s];
+                int sy = y - surface->y;
+                int from = r->x0 > surface->x ? r->x0 : surface->x;
+                int to = x1 < surface->x + surface->w ? x1 : surface->x + surface->w;
+                if (!surface->visible || sy < 0 || sy >= surface->h)
+                {
+                    continue;
+                }
+
+                const __nconio_cell *cell = surface->cells + (size_t)sy * surface->w + (from - surface->x);
+                for (int x = from; x < to; x++, cell++)
+                {
+                    if (cell->ch != 0)
+                    {
+                        row[x - r->x0] = *cell;
+                    }
+                }
+            }
+            __nconio_fixwide(row, x1 - r->x0, r->x0, y);
+            __nconio_putcells(row, x1 - r->x0, r->x0, y);
+        }
+    }
+    __nconio_dirtycount = 0;
+}
+
+static nconio_surface *__nconio_newsurface(int w, int h, int z)
+{
+    nconio_surface *s;
+    int at;
+
+    if (w <= 0 || h <= 0)
+    {
+        return NULL;
+    }
+    if (__nconio_surfacecount == __nconio_surfacecap)
+    {
+        int cap = __nconio_surfacecap ? __nconio_surfacecap * 2 : 8;
+        nconio_surface **list = (nconio_surface **)realloc(__nconio_surfaces, (size_t)cap * sizeof(nconio_surface *));
+        if (list == NULL)
+        {
+            return NULL;
+        }
+        __nconio_surfaces = list;
+        __nconio_surfacecap = cap;
+    }
+
+    s = (nconio_surface *)malloc(sizeof(nconio_surface));
+    if (s == NULL || __nconio_getbase() == NULL)
+    {
+        free(s);
+        return NULL;
+    }
+    s->cells = (__nconio_cell *)malloc((size_t)w * h * sizeof(__nconio_cell));
+    if (s->cells == NULL)
+    {
+        free(s);
+        return NULL;
+    }
+    __nconio_cell clear = {0, 0};
+    __nconio_fillcells(s->cells, (size_t)w * h, clear);
+    s->w = w;
+    s->h = h;
+    s->x = 0;
+    s->y = 0;
+    s->z = z;
+    s->visible = 1;
+
+    // In front of the surfaces with the same z
+    for (at = __nconio_surfacecount; at > 0 && __nconio_surfaces[at - 1]->z > z; at--)
+    {
+        __nconio_surfaces[at] = __nconio_surfaces[at - 1];
+    }
+    __nconio_surfaces[at] = s;
+    __nconio_surfacecount++;
+    return s;
+}
+
+nconio_surface *nconio_newsurface(int w, int h, int z)
+{
+    __nconio_rt_lock();
+    nconio_surface *s = __nconio_newsurface(w, h, z);
+    __nconio_rt_unlock();
+    return s;
+}
+
+void nconio_freesurface(nconio_surface *surface)
+{
+    int at = 0;
+
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_FREESURFACE, 0, 0, 0, 0, &surface, (int)sizeof(surface));
+        return;
+    }
+    if (surface == NULL)
+    {
+        return;
+    }
+    while (at < __nconio_surfacecount && __nconio_surfaces[at] != surface)
+    {
+        at++;
+    }
+    if (at == __nconio_surfacecount)
+    {
+        return;
+    }
+
+    memmove(__nconio_surfaces + at, __nconio_surfaces + at + 1, (size_t)(__nconio_surfacecount - at - 1) * sizeof(nconio_surface *));
+    __nconio_surfacecount--;
+    if (__nconio_target == surface)
+    {
+        __nconio_target = NULL;
+    }
+
+    // What it covered comes back from below
+    if (surface->visible)
+    {
+        __nconio_dirtysurface(surface);
+        __nconio_touch();
+    }
+    free(surface->cells);
+    free(surface);
+}
+
+static void __nconio_freesurfaces(void)
+{
+    for (int i = 0; i < __nconio_surfacecount; i++)
+    {
+        free(__nconio_surfaces[i]->cells);
+        free(__nconio_surfaces[i]);
+    }
+    free(__nconio_surfaces);
+    __nconio_surfaces = NULL;
+    __nconio_surfacecount = 0;
+    __nconio_surfacecap = 0;
+    __nconio_target = NULL;
+    __nconio_dirtycount = 0;
+}
+
+void nconio_settarget(nconio_surface *surface)
+{
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_SETTARGET, 0, 0, 0, 0, &surface, (int)sizeof(surface));
+        return;
+    }
+    __nconio_target = surface;
+}
+
+void nconio_movesurface(nconio_surface *surface, int x, int y)
+{
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_MOVESURFACE, x, y, 0, 0, &surface, (int)sizeof(surface));
+        return;
+    }
+    if (surface == NULL || (surface->x == x && surface->y == y))
+    {
+        return;
+    }
+    if (surface->visible)
+    {
+        __nconio_dirtysurface(surface); // Where it was
+    }
+    surface->x = x;
+    surface->y = y;
+    if (surface->visible)
+    {
+        __nconio_dirtysurface(surface);
+        __nconio_touch();
+    }
+}
+
+void nconio_showsurface(nconio_surface *surface, int visible)
+{
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_SHOWSURFACE, visible, 0, 0, 0, &surface, (int)sizeof(surface));
+        return;
+    }
+    if (surface == NULL || surface->visible == !!visible)
+    {
+        return;
+    }
+    surface->visible = !!visible;
+    __nconio_dirtysurface(surface);
+    __nconio_touch();
+}
+
+// ##################################################################
+//    Common: Unicode text
+// ##################################################################
+
+// Cells being filled with glyphs and not drawn yet, kept by a sweep
+static const __nconio_cell *__nconio_pendingcells = NULL;
+static int __nconio_pendingcount = 0;
+
+static void __nconio_markglyphs(unsigned char *used, const __nconio_cell *cells, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned int index = (unsigned int)cells[i].ch - __NCONIO_ASTRALFIRST;
+        if (index < (unsigned int)__nconio_astralcount)
+        {
+            used[index] = 1;
+        }
+    }
+}
+
+// Free the glyphs of code points above U+FFFF that no cell holds any more: not
+// the back, front or base buffer, no surface and no pending cell. Returns how
+// many were freed. The glyphs left keep their numbers, the table that finds
+// them is built anew.
+static int __nconio_sweepglyphs(void)
+{
+    static unsigned char used[__NCONIO_ASTRALMAX];
+    size_t count = (size_t)__nconio_w * __nconio_h;
+
+    memset(used, 0, sizeof(used));
+    if (__nconio_back != NULL)
+    {
+        __nconio_markglyphs(used, __nconio_back, count);
+        __nconio_markglyphs(used, __nconio_front, count);
+    }
+    if (__nconio_base != NULL)
+    {
+        __nconio_markglyphs(used, __nconio_base, count);
+    }
+    for (int s = 0; s < __nconio_surfacecount; s++)
+    {
+        const nconio_surface *surface = __nconio_surfaces[s];
+        __nconio_markglyphs(used, surface->cells, (size_t)surface->w * surface->h);
+    }
+    if (__nconio_pendingcells != NULL)
+    {
+        __nconio_markglyphs(used, __nconio_pendingcells, (size_t)__nconio_pendingcount);
+    }
+
+    memset(__nconio_astralhash, 0, sizeof(__nconio_astralhash));
+    __nconio_astralfreecount = 0;
+    for (int i = __nconio_astralcount - 1; i >= 0; i--)
+    {
+        if (used[i])
+        {
+            __nconio_astralhash[__nconio_astralslot(__nconio_astral[i])] = (unsigned short)(__NCONIO_ASTRALFIRST + i);
+        }
+        else
+        {
+            __nconio_astral[i] = 0;
+            __nconio_astralfree[__nconio_astralfreecount++] = (unsigned short)(__NCONIO_ASTRALFIRST + i);
+        }
+    }
+    return __nconio_astralfreecount;
+}
+
+// Draw cells made from code points on the target surface, or the screen if there is none
+static void __nconio_drawcells(const __nconio_cell *cells, int count, int x, int y)
+{
+    nconio_surface *s = __nconio_target;
+    int x0, x1;
+
+    if (s)
+    {
+        if (y >= 0 && y < s->h)
+        {
+            __nconio_writecells(s->cells + (size_t)y * s->w, s->w, cells, count, x, &x0, &x1);
+            if (x0 < x1 && s->visible)
+            {
+                __nconio_adddirty(s->x + x0, s->y + y, x1 - x0, 1);
+            }
+        }
+        return;
+    }
+    if (y >= 0 && y < __nconio_h)
+    {
+        __nconio_cell *row = __nconio_back + (size_t)y * __nconio_w;
+        __nconio_writecells(row, __nconio_w, cells, count, x, &x0, &x1);
+        if (x0 < x1)
+        {
+            __nconio_screendirty(x0, y, x1 - x0, 1);
+            __nconio_putcells(row + x0, x1 - x0, x0, y); // The Windows console is written right away
+        }
+    }
+}
+
+// Next code point of the UTF-8 text at s of len bytes, at *i
+static unsigned int __nconio_utf8next(const char *s, int len, int *i)
+{
+    unsigned int cp;
+    int used = __nconio_utf8decode(s + *i, len - *i, &cp);
+    if (used == 0)
+    {
+        cp = 0xfffd; // Cut off at the end of the text
+        used = 1;
+    }
+    *i += used;
+    return cp;
+}
+
+void nconio_putcp(unsigned int cp, int x, int y)
+{
+    __nconio_cell cells[2];
+    int width = cp < 0x80 ? 1 : nconio_cpwidth(cp); // Control characters are drawn as blanks, like with putchat
+
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_PUTCP, (int)cp, x, y, 0, NULL, 0);
+        return;
+    }
+    if (width == 0)
+    {
+        return;
+    }
+    cells[0].ch = __nconio_glyph(cp);
+    cells[0].style = (unsigned short)__nconio_style;
+    cells[1].ch = __NCONIO_WIDETAIL;
+    cells[1].style = (unsigned short)__nconio_style;
+    __nconio_drawcells(cells, width, x, y);
+    __nconio_touch();
+}
+
+int nconio_pututf8(const char *str, int x, int y)
+{
+    __nconio_cell cells[256];
+    int len = (int)strlen(str), i = 0, n = 0, width = 0;
+
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_PUTUTF8, x, y, 0, 0, str, len + 1);
+        while (i < len)
+        {
+            unsigned int cp = __nconio_utf8next(str, len, &i);
+            width += cp < 0x80 ? 1 : nconio_cpwidth(cp);
+        }
+        return width;
+    }
+
+    while (i < len)
+    {
+        // ASCII is copied as it is, without decoding or looking up widths
+        while (i < len && n < 256 && (unsigned char)str[i] < 0x80)
+        {
+            cells[n].ch = (unsigned char)str[i++];
+            cells[n++].style = (unsigned short)__nconio_style;
+        }
+        if (i < len && n < 255)
+        {
+            unsigned int cp = __nconio_utf8next(str, len, &i);
+            int w = nconio_cpwidth(cp);
+            if (w > 0)
+            {
+                __nconio_pendingcells = cells;
+                __nconio_pendingcount = n;
+                cells[n].ch = __nconio_glyph(cp);
+                __nconio_pendingcells = NULL;
+                cells[n++].style = (unsigned short)__nconio_style;
+            }
+            if (w == 2)
+            {
+                cells[n].ch = __NCONIO_WIDETAIL;
+                cells[n++].style = (unsigned short)__nconio_style;
+            }
+            continue;
+        }
+        __nconio_drawcells(cells, n, x + width, y);
+        width += n;
+        n = 0;
+    }
+    __nconio_drawcells(cells, n, x + width, y);
+    width += n;
+    __nconio_touch();
+    return width;
+}
+
+// ##################################################################
+//    Common: tilemaps
+// ##################################################################
+
+// How a tile is drawn, style -1 is the current style
+typedef struct __nconio_tilelook
+{
+    unsigned int cp;
+    int style;
+} __nconio_tilelook;
+
+// A slot of the hash table that finds the chunks of a map, tiles is NULL if it is empty
+typedef struct __nconio_tilechunk
+{
+    int cx, cy;
+    unsigned char *tiles;
+} __nconio_tilechunk;
+
+struct nconio_tilemap
+{
+    __nconio_tilechunk *chunks; // Open addressing with linear probing
+    int chunkcount;
+    int chunkcap; // A power of two, 0 until the first chunk is set
+    __nconio_tilelook looks[256];
+};
+
+#define __NCONIO_CHUNKTILES (NCONIO_CHUNK * NCONIO_CHUNK)
+
+// The chunk a map coordinate falls into, rounding down for negative ones
+#define __NCONIO_CHUNKOF(v) ((v) >= 0 ? (v) / NCONIO_CHUNK : -((-(v) - 1) / NCONIO_CHUNK) - 1)
+
+static unsigned int __nconio_chunkhash(int cx, int cy)
+{
+    return (unsigned int)cx * 2654435761u ^ (unsigned int)cy * 2246822519u;
+}
+
+// Slot of chunk cx, cy in the hash table, or the empty slot where it would go
+static int __nconio_chunkslot(const nconio_tilemap *map, int cx, int cy)
+{
+    unsigned int mask = (unsigned int)map->chunkcap - 1;
+    unsigned int slot = __nconio_chunkhash(cx, cy) & mask;
+
+    while (map->chunks[slot].tiles != NULL && (map->chunks[slot].cx != cx || map->chunks[slot].cy != cy))
+    {
+        slot = (slot + 1) & mask;
+    }
+    return (int)slot;
+}
+
+// The tiles of chunk cx, cy, NULL if it was not set
+static const unsigned char *__nconio_findchunk(const nconio_tilemap *map, int cx, int cy)
+{
+    return map->chunkcap > 0 ? map->chunks[__nconio_chunkslot(map, cx, cy)].tiles : NULL;
+}
+
+// Rebuild the hash table with room for twice as many chunks
+static int __nconio_growchunks(nconio_tilemap *map)
+{
+    int oldcap = map->chunkcap;
+    unsigned int cap = oldcap ? (unsigned int)oldcap * 2 : 16;
+    __nconio_tilechunk *old = map->chunks;
+    __nconio_tilechunk *chunks = (__nconio_tilechunk *)calloc(cap, sizeof(__nconio_tilechunk));
+
+    if (chunks == NULL)
+    {
+        return 0;
+    }
+    map->chunks = chunks;
+    map->chunkcap = (int)cap;
+    for (int i = 0; i < oldcap; i++)
+    {
+        if (old[i].tiles != NULL)
+        {
+            map->chunks[__nconio_chunkslot(map, old[i].cx, old[i].cy)] = old[i];
+        }
+    }
+    free(old);
+    return 1;
+}
+
+// The tiles of chunk cx, cy, added with all tiles 0 if it was not set. NULL if out of memory.
+static unsigned char *__nconio_addchunk(nconio_tilemap *map, int cx, int cy)
+{
+    if (map->chunkcap > 0)
+    {
+        __nconio_tilechunk *chunk = &map->chunks[__nconio_chunkslot(map, cx, cy)];
+        if (chunk->tiles != NULL)
+        {
+            return chunk->tiles;
+        }
+    }
+    if ((map->chunkcount + 1) * 2 > map->chunkcap && !__nconio_growchunks(map)) // At most half full
+    {
+        return NULL;
+    }
+
+    unsigned char *tiles = (unsigned char *)calloc(__NCONIO_CHUNKTILES, 1);
+    if (tiles == NULL)
+    {
+        return NULL;
+    }
+    __nconio_tilechunk *chunk = &map->chunks[__nconio_chunkslot(map, cx, cy)];
+    chunk->cx = cx;
+    chunk->cy = cy;
+    chunk->tiles = tiles;
+    map->chunkcount++;
+    return tiles;
+}
+
+// Free chunk cx, cy. The chunks probed past its slot move back into the hole,
+// where they are found again.
+static void __nconio_removechunk(nconio_tilemap *map, int cx, int cy)
+{
+    if (map->chunkcap == 0)
+    {
+        return;
+    }
+
+    unsigned int mask = (unsigned int)map->chunkcap - 1;
+    unsigned int hole = (unsigned int)__nconio_chunkslot(map, cx, cy);
+    if (map->chunks[hole].tiles == NULL)
+    {
+        return;
+    }
+    free(map->chunks[hole].tiles);
+    map->chunks[hole].tiles = NULL;
+    map->chunkcount--;
+
+    for (unsigned int slot = (hole + 1) & mask; map->chunks[slot].tiles != NULL; slot = (slot + 1) & mask)
+    {
+        unsigned int home = __nconio_chunkhash(map->chunks[slot].cx, map->chunks[slot].cy) & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) // The hole lies between its home slot and where it is
+        {
+            map->chunks[hole] = map->chunks[slot];
+            map->chunks[slot].tiles = NULL;
+            hole = slot;
+        }
+    }
+}
+
+// Copy count tiles of row y of the map, from x on
+static void __nconio_tilerow(const nconio_tilemap *map, int x, int y, int count, unsigned char *tiles)
+{
+    int cy = __NCONIO_CHUNKOF(y);
+    int ty = y - cy * NCONIO_CHUNK;
+
+    while (count > 0)
+    {
+        int cx = __NCONIO_CHUNKOF(x);
+        int tx = x - cx * NCONIO_CHUNK;
+        int n = NCONIO_CHUNK - tx < count ? NCONIO_CHUNK - tx : count;
+        const unsigned char *chunk = __nconio_findchunk(map, cx, cy);
+
+        if (chunk != NULL)
+        {
+            memcpy(tiles, chunk + ty * NCONIO_CHUNK + tx, (size_t)n);
+        }
+        else
+        {
+            memset(tiles, 0, (size_t)n);
+        }
+        tiles += n;
+        x += n;
+        count -= n;
+    }
+}
+
+// The cells the 256 tiles are drawn as, taking the current style where they have none
+static void __nconio_tilecells(const __nconio_tilelook *looks, __nconio_cell *cells)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        int style = looks[i].style >= 0 && looks[i].style < __nconio_stylecount ? looks[i].style : __nconio_style;
+        __nconio_pendingcells = cells;
+        __nconio_pendingcount = i;
+        cells[i].ch = __nconio_glyph(looks[i].cp);
+        __nconio_pendingcells = NULL;
+        cells[i].style = (unsigned short)style;
+    }
+}
+
+// Draw a row of tiles on the target surface, or the screen if there is none
+static void __nconio_puttiles(const unsigned char *tiles, const __nconio_cell *cells, int count, int x, int y)
+{
+    __nconio_cell row[256];
+
+    for (int i = 0; i < count; i += 256)
+    {
+        int n = count - i < 256 ? count - i : 256;
+        for (int k = 0; k < n; k++)
+        {
+            row[k] = cells[tiles[i + k]];
+        }
+        __nconio_drawcells(row, n, x + i, y);
+    }
+}
+
+nconio_tilemap *nconio_newtilemap(void)
+{
+    nconio_tilemap *map = (nconio_tilemap *)calloc(1, sizeof(nconio_tilemap));
+
+    if (map == NULL)
+    {
+        return NULL;
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        map->looks[i].cp = __NCONIO_BYTECP(i);
+        map->looks[i].style = -1;
+    }
+    return map;
+}
+
+void nconio_freetilemap(nconio_tilemap *map)
+{
+    if (map == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < map->chunkcap; i++)
+    {
+        free(map->chunks[i].tiles);
+    }
+    free(map->chunks);
+    free(map);
+}
+
+void nconio_deftile(nconio_tilemap *map, int tile, unsigned int cp, nconio_style style)
+{
+    if (map == NULL || tile < 0 || tile > 255)
+    {
+        return;
+    }
+    if (cp >= 0x80 && nconio_cpwidth(cp) != 1)
+    {
+        cp = ' '; // A tile is one cell
+    }
+    map->looks[tile].cp = cp;
+    map->looks[tile].style = style < 0 ? -1 : style;
+}
+
+int nconio_setchunk(nconio_tilemap *map, int cx, int cy, const unsigned char *tiles)
+{
+    unsigned char *chunk;
+
+    if (map == NULL)
+    {
+        return 0;
+    }
+    if (tiles == NULL)
+    {
+        __nconio_removechunk(map, cx, cy);
+        return 1;
+    }
+    chunk = __nconio_addchunk(map, cx, cy);
+    if (chunk == NULL)
+    {
+        return 0;
+    }
+    memcpy(chunk, tiles, __NCONIO_CHUNKTILES);
+    return 1;
+}
+
+int nconio_settile(nconio_tilemap *map, int x, int y, int tile)
+{
+    int cx = __NCONIO_CHUNKOF(x), cy = __NCONIO_CHUNKOF(y);
+    unsigned char *chunk;
+
+    if (map == NULL)
+    {
+        return 0;
+    }
+    if (tile == 0 && __nconio_findchunk(map, cx, cy) == NULL)
+    {
+        return 1; // Already 0, no chunk needed
+    }
+    chunk = __nconio_addchunk(map, cx, cy);
+    if (chunk == NULL)
+    {
+        return 0;
+    }
+    chunk[(y - cy * NCONIO_CHUNK) * NCONIO_CHUNK + (x - cx * NCONIO_CHUNK)] = (unsigned char)tile;
+    return 1;
+}
+
+int nconio_gettile(const nconio_tilemap *map, int x, int y)
+{
+    int cx = __NCONIO_CHUNKOF(x), cy = __NCONIO_CHUNKOF(y);
+    const unsigned char *chunk = map ? __nconio_findchunk(map, cx, cy) : NULL;
+
+    return chunk ? chunk[(y - cy * NCONIO_CHUNK) * NCONIO_CHUNK + (x - cx * NCONIO_CHUNK)] : 0;
+}
+
+void nconio_drawtilemap(const nconio_tilemap *map, int mapx, int mapy, int x, int y, int w, int h)
+{
+    __nconio_cell cells[256];
+    unsigned char tiles[256];
+
+    if (map == NULL)
+    {
+        return;
+    }
+    if (x < 0)
+    {
+        mapx -= x;
+        w += x;
+        x = 0;
+    }
+    if (y < 0)
+    {
+        mapy -= y;
+        h += y;
+        y = 0;
+    }
+    if (w <= 0 || h <= 0)
+    {
+        return;
+    }
+
+    if (__nconio_rt_active())
+    {
+        // The map stays with the drawing thread, the render thread gets the
+        // looks and the visible tiles. The last row marks the end of the call.
+        char *looks = __nconio_rt_begin(__NCONIO_RT_TILELOOKS, 0, 0, 0, 0, (int)sizeof(map->looks));
+        if (looks == NULL)
+        {
+            return; // Larger than the ring, never queued
+        }
+        memcpy(looks, map->looks, sizeof(map->looks));
+        __nconio_rt_end();
+        for (int row = 0; row < h; row++)
+        {
+            char *data = __nconio_rt_begin(__NCONIO_RT_PUTTILES, w, x, y + row, row == h - 1, w);
+            if (data)
+            {
+                __nconio_tilerow(map, mapx, mapy + row, w, (unsigned char *)data);
+                __nconio_rt_end();
+            }
+        }
+        return;
+    }
+
+    // Only the tiles in view of the target are looked up
+    int tw = __nconio_target ? __nconio_target->w : __nconio_w;
+    int th = __nconio_target ? __nconio_target->h : __nconio_h;
+    w = w < tw - x ? w : tw - x;
+    h = h < th - y ? h : th - y;
+
+    __nconio_tilecells(map->looks, cells);
+    for (int row = 0; row < h; row++)
+    {
+        for (int i = 0; i < w; i += 256)
+        {
+            int n = w - i < 256 ? w - i : 256;
+            __nconio_tilerow(map, mapx + i, mapy + row, n, tiles);
+            __nconio_puttiles(tiles, cells, n, x + i, y + row);
+        }
+    }
+    __nconio_touch();
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+    // ##################################################################
+    //    Windows
+    // ##################################################################
+
+#include <windows.h>
+    // Global variable to hold the current text and background color attributes
+    static WORD __nconio_currentAttributes = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
+
+    BOOL WINAPI __ctrl_handler(DWORD fdwCtrlType)
+    {
+        switch (fdwCtrlType)
+        {
+        case CTRL_C_EVENT:
+            return TRUE; // Handle the CTRL-C signal
+        default:
+            return FALSE;
+        }
+    }
+
+    // Console output is written right away by every call, so there is nothing to send here
+    static unsigned long __nconio_present(void)
+    {
+        return 0;
+    }
+
+    // Console writes do not block on a slow link the way a terminal does
+    void nconio_setoutputlimit(int kb)
+    {
+        (void)kb;
+    }
+
+    // Keep the current attributes in the screen model colors as well
+    static void __nconio_win_setattributes(WORD attributes)
+    {
+        __nconio_currentAttributes = attributes;
+        __nconio_style = __nconio_attrtostyle((unsigned char)attributes);
+    }
+
+    // Read what the console window shows into the screen model. Afterwards every
+    // drawing call writes through to the model, so getchat never asks the console.
+    static void __nconio_win_loadscreen(void)
+    {
+        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+        CHAR_INFO buf[256];
+
+        if (!__nconio_allocscreen(conw(), conh()))
+        {
+            return;
+        }
+        __nconio_cleared = 0; // The console is not cleared, we mirror it
+
+        for (int y = 0; y < __nconio_h; y++)
+        {
+            for (int x = 0; x < __nconio_w; x += 256)
+            {
+                int n = __nconio_w - x < 256 ? __nconio_w - x : 256;
+                COORD size = {(SHORT)n, 1};
+                COORD origin = {0, 0};
+                SMALL_RECT region = {(SHORT)x, (SHORT)y, (SHORT)(x + n - 1), (SHORT)y};
+
+                if (!ReadConsoleOutputW(hConsole, buf, size, origin, &region))
+                {
+                    continue;
+                }
+                for (int i = 0; i < n; i++)
+                {
+                    __nconio_cell *cell = &__nconio_back[y * __nconio_w + x + i];
+                    unsigned int cp = buf[i].Char.UnicodeChar;
+                    cell->ch = (unsigned short)((buf[i].Attributes & COMMON_LVB_TRAILING_BYTE) ? __NCONIO_WIDETAIL : (cp >= 0xd800 && cp <= 0xdfff) ? 0xfffd : cp);
+                    cell->style = (unsigned short)__nconio_attrtostyle((unsigned char)buf[i].Attributes);
+                }
+            }
+        }
+    }
+
+    static DWORD __nconio_win_inputmode = 0; // Console input mode before nconioinit
+    static HANDLE __nconio_win_timer = NULL; // Waitable timer of nconio_settimer
+    static int __nconio_win_resized = 0;     // A resize was seen since the last nconio_wait
+
+    void nconioinit(void)
+    {
+        HANDLE hInput = GetStdHandle(STD_INPUT_HANDLE);
+
+        __nconio_resetstyles();
+        __nconio_resetglyphs();
+        __nconio_win_setattributes(FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+        nconio_resetstats();
+        __nconio_resetinput();
+        __nconio_win_loadscreen();
+
+        // Report resizes in the console input, for nconio_wait
+        __nconio_win_resized = 0;
+        GetConsoleMode(hInput, &__nconio_win_inputmode);
+        SetConsoleMode(hInput, __nconio_win_inputmode | ENABLE_WINDOW_INPUT);
+
+        // Disable Ctrl-C
+        SetConsoleCtrlHandler((PHANDLER_ROUTINE)__ctrl_handler, TRUE);
+    }
+
+    void nconiocleanup(void)
+    {
+        showcursor();          // Show cursor on exit
+        textcolorreset();      // Reset the text color
+        textbackgroundreset(); // reset the background color
+
+        // Re-enable Ctrl-C
+        SetConsoleCtrlHandler((PHANDLER_ROUTINE)__ctrl_handler, FALSE);
+        SetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), __nconio_win_inputmode);
+        if (__nconio_win_timer)
+        {
+            CloseHandle(__nconio_win_timer);
+            __nconio_win_timer = NULL;
+        }
+        __nconio_freesurfaces();
+        __nconio_freescreen();
+        __nconio_freestyles();
+    }
+
+#ifdef NCONIO_THREADS
+    // There is no render thread on Windows, drawing calls run on the calling thread
+    int nconio_startrender(int queue_kb, int policy)
+    {
+        (void)queue_kb;
+        (void)policy;
+        return 0;
+    }
+
+    void nconio_stoprender(void)
+    {
+    }
+
+    unsigned long nconio_droppedframes(void)
+    {
+        return 0;
+    }
+#endif
+
+    static long long __nconio_now(void)
+    {
+        LARGE_INTEGER frequency, counter;
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&counter);
+        return (long long)(counter.QuadPart / frequency.QuadPart * 1000000 +
+                           counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+    }
+
+    static void __nconio_sleep(long long us)
+    {
+        if (us > 0)
+        {
+            Sleep((DWORD)((us + 999) / 1000));
+        }
+    }
+
+    // Queue the key presses waiting in the console input
+    static int __nconio_pollinput(int timeout_ms)
+    {
+        HANDLE hInput = GetStdHandle(STD_INPUT_HANDLE);
+        INPUT_RECORD records[64];
+        DWORD count = 0;
+        int queued = 0;
+
+        if (WaitForSingleObject(hInput, timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms) != WAIT_OBJECT_0)
+        {
+            return 0;
+        }
+        if (!GetNumberOfConsoleInputEvents(hInput, &count) || count == 0)
+        {
+            return 0;
+        }
+
+        // There are events waiting, so this does not block
+        if (!ReadConsoleInputA(hInput, records, 64, &count))
+        {
+            return 0;
+        }
+        for (DWORD i = 0; i < count; ++i)
+        {
+            if (records[i].EventType == KEY_EVENT && records[i].Event.KeyEvent.bKeyDown)
+            {
+                __nconio_pushkey(records[i].Event.KeyEvent.wVirtualKeyCode, (unsigned char)records[i].Event.KeyEvent.uChar.AsciiChar);
+                queued = 1;
+            }
+            else if (records[i].EventType == WINDOW_BUFFER_SIZE_EVENT)
+            {
+                __nconio_win_resized = 1;
+            }
+        }
+        return queued;
+    }
+
+    int nconio_wait(int timeout_ms)
+    {
+        HANDLE handles[2] = {GetStdHandle(STD_INPUT_HANDLE), __nconio_win_timer};
+        DWORD count = __nconio_win_timer ? 2 : 1;
+        int events = 0;
+
+        __nconio_syncinput();
+        for (;;)
+        {
+            DWORD timeout = __nconio_keycount > 0 || __nconio_win_resized ? 0 : timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms;
+            DWORD r = WaitForMultipleObjects(count, handles, FALSE, timeout);
+
+            if (r == WAIT_OBJECT_0)
+            {
+                __nconio_pollinput(0);
+            }
+            if (__nconio_win_timer && WaitForSingleObject(__nconio_win_timer, 0) == WAIT_OBJECT_0)
+            {
+                events |= NCONIO_EVENT_TIMER;
+            }
+            else if (r == WAIT_OBJECT_0 + 1)
+            {
+                events |= NCONIO_EVENT_TIMER;
+            }
+            if (__nconio_keycount > 0)
+            {
+                events |= NCONIO_EVENT_KEY;
+            }
+            if (__nconio_win_resized)
+            {
+                events |= NCONIO_EVENT_RESIZE;
+                __nconio_win_resized = 0;
+            }
+
+            // Console input that was no key press (e.g. mouse or focus) wakes the wait too
+            if (events || r == WAIT_TIMEOUT || r == WAIT_FAILED || timeout_ms >= 0)
+            {
+                return events;
+            }
+        }
+    }
+
+    void nconio_settimer(int interval_ms)
+    {
+        if (interval_ms <= 0)
+        {
+            if (__nconio_win_timer)
+            {
+                CancelWaitableTimer(__nconio_win_timer);
+            }
+            return;
+        }
+        if (!__nconio_win_timer)
+        {
+            __nconio_win_timer = CreateWaitableTimer(NULL, FALSE, NULL);
+        }
+        if (__nconio_win_timer)
+        {
+            LARGE_INTEGER due;
+            due.QuadPart = -(LONGLONG)interval_ms * 10000; // Relative, in 100 ns units
+            SetWaitableTimer(__nconio_win_timer, &due, interval_ms, NULL, NULL, FALSE);
+        }
+    }
+
+    // Custom implementation of clrscr for Windows
+    void clrscr(void)
+    {
+        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+        COORD coordScreen = {0, 0}; // Home for the cursor
+        DWORD cCharsWritten;
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        DWORD dwConSize;
+
+        if (__nconio_target)
+        {
+            __nconio_clearsurface();
+            __nconio_touch(); // Composited unless a frame is being collected
+            return;
+        }
+
+        // Get the number of character cells in the current buffer
+        if (!GetConsoleScreenBufferInfo(hConsole, &csbi))
+        {
+            return;
+        }
+
+        dwConSize = csbi.dwSize.X * csbi.dwSize.Y;
+
+        // Fill the entire screen with blanks
+        if (!FillConsoleOutputCharacter(hConsole,        // Handle to console screen buffer
+                                        (TCHAR)' ',      // Character to write to the buffer
+                                        dwConSize,       // Number of cells to write
+                                        coordScreen,     // Coordinates of first cell
+                                        &cCharsWritten)) // Receive number of characters written
+        {
+            return;
+        }
+
+        // Get the current text attribute
+        if (!GetConsoleScreenBufferInfo(hConsole, &csbi))
+        {
+            return;
+        }
+
+        // Set the buffer's attributes accordingly
+        if (!FillConsoleOutputAttribute(hConsole,         // Handle to console screen buffer
+                                        csbi.wAttributes, // Character attributes to use
+                                        dwConSize,        // Number of cells to set attribute
+                                        coordScreen,      // Coordinates of first cell
+                                        &cCharsWritten))  // Receive number of characters written
+        {
+            return;
+        }
+
+        // Put the cursor at its home coordinates
+        SetConsoleCursorPosition(hConsole, coordScreen);
+        __NCONIO_COUNT(writes, 2);
+        __NCONIO_COUNT(emitted, dwConSize);
+        __NCONIO_COUNT(moves, 1);
+
+        // Mirror the cleared screen in the model
+        __nconio_cell blank = {' ', (unsigned short)__nconio_attrtostyle((unsigned char)csbi.wAttributes)};
+        __nconio_fillcells(__nconio_back, (size_t)__nconio_w * __nconio_h, blank);
+        __nconio_screendirty(0, 0, __nconio_w, __nconio_h);
+        if (__nconio_dirtycount)
+        {
+            __nconio_touch(); // Put the surfaces back on top
+        }
+    }
+
+    void gotoxy(int x, int y)
+    {
+        // Create a COORD structure with the desired cursor position
+        COORD coord = {(SHORT)x, (SHORT)y};
+
+        // Get the console output handle
+        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+
+        // Set the cursor position
+        SetConsoleCursorPosition(hConsole, coord);
+        __NCONIO_COUNT(moves, 1);
+    }
+
+    int putchr(int ch)
+    {
+        // Get the standard output handle
+        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+        DWORD written;
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+
+        // Mirror the character in the model at the cursor position
+        if (ch >= 0x20 && GetConsoleScreenBufferInfo(hConsole, &csbi))
+        {
+            __nconio_setcell(csbi.dwCursorPosition.X, csbi.dwCursorPosition.Y, (char)ch);
+        }
+
+        // Write the character to the console
+        __NCONIO_COUNT(writes, 1);
+        __NCONIO_COUNT(emitted, 1);
+        if (WriteConsole(hConsole, &ch, 1, &written, NULL))
+        {
+            return ch; // Return the character written if successful
+        }
+
+        return 0; // Return 0 if there was an error
+    }
+
+    void putchat(char ch, int x, int y)
+    {
+        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+        COORD pos = {(SHORT)x, (SHORT)y};
+        DWORD written;
+
+        if (__nconio_surfacedraw(&ch, NULL, 1, x, y))
+        {
+            __nconio_touch(); // Composited unless a frame is being collected
+            return;
+        }
+        WriteConsoleOutputCharacter(hConsole, &ch, 1, pos, &written);
+        __NCONIO_COUNT(writes, 1);
+        __NCONIO_COUNT(emitted, 1);
+
+        // Only the character changes, the cell keeps its attributes
+        if (x >= 0 && y >= 0 && x < __nconio_w && y < __nconio_h)
+        {
+            __nconio_cell *row = &__nconio_back[y * __nconio_w];
+            int x0 = x, x1 = x + 1;
+            __nconio_splitwide(row, __nconio_w, &x0, &x1);
+            row[x].ch = __NCONIO_BYTECP(ch);
+            __nconio_screendirty(x0, y, x1 - x0, 1);
+            if (x1 - x0 > 1)
+            {
+                __nconio_putcells(row + x0, x1 - x0, x0, y); // A wide character lost a half
+            }
+        }
+        if (__nconio_dirtycount)
+        {
+            __nconio_touch(); // Put the surfaces back on top
+        }
+    }
+
+    void putrow(const char *chars, const unsigned char *attrs, int count, int x, int y)
+    {
+        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+        CHAR_INFO buf[256];
+        int width = conw();
+        const __nconio_styledef *def = &__nconio_styles[__nconio_style];
+        WORD attr = NCONIO_ATTR(__nconio_to16(def->fg), __nconio_to16(def->bg)); // The console has 16 colors and no attributes
+
+        if (__nconio_surfacedraw(chars, attrs, count, x, y))
+        {
+            __nconio_touch(); // Composited unless a frame is being collected
+            return;
+        }
+        __nconio_blitrow(chars, attrs, count, x, y); // Mirror the row in the model
+        if (__nconio_dirtycount)
+        {
+            __nconio_touch(); // Put the surfaces back on top
+        }
+        if (y < 0 || y >= conh())
+        {
+            return;
+        }
+        if (x < 0)
+        {
+            chars -= x;
+            attrs = attrs ? attrs - x : NULL;
+            count += x;
+            x = 0;
+        }
+        if (count > width - x)
+        {
+            count = width - x;
+        }
+
+        // NCONIO_ATTR values are console attributes already, write the row in chunks
+        while (count > 0)
+        {
+            int n = count < 256 ? count : 256;
+            COORD size = {(SHORT)n, 1};
+            COORD origin = {0, 0};
+            SMALL_RECT region = {(SHORT)x, (SHORT)y, (SHORT)(x + n - 1), (SHORT)y};
+
+            for (int i = 0; i < n; i++)
+            {
+                buf[i].Char.AsciiChar = chars[i];
+                buf[i].Attributes = attrs ? attrs[i] : attr;
+            }
+            WriteConsoleOutputA(hConsole, buf, size, origin, &region);
+            __NCONIO_COUNT(writes, 1);
+            __NCONIO_COUNT(emitted, n);
+
+            chars += n;
+            attrs = attrs ? attrs + n : NULL;
+            count -= n;
+            x += n;
+        }
+    }
+
+    // The UTF-16 unit the console shows for a code point. Bytes put with the
+    // char functions are read in the console's code page.
+    static WCHAR __nconio_win_wchar(unsigned int cp)
+    {
+        if (__NCONIO_ISBYTE(cp))
+        {
+            char byte = (char)(cp - 0xdc00);
+            WCHAR wc = L'?';
+            MultiByteToWideChar(GetConsoleOutputCP(), 0, &byte, 1, &wc, 1);
+            return wc;
+        }
+        return cp > 0xffff ? 0xfffd : (WCHAR)cp; // A cell holds one UTF-16 unit
+    }
+
+    // Write cells to the console and mirror them in the model. A wide character
+    // fills both its cells, marked as the leading and the trailing half.
+    static void __nconio_putcells(const __nconio_cell *cells, int count, int x, int y)
+    {
+        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+        CHAR_INFO buf[256];
+
+        memmove(&__nconio_back[y * __nconio_w + x], cells, (size_t)count * sizeof(__nconio_cell));
+        while (count > 0)
+        {
+            int n = count < 256 ? count : 256;
+            COORD size = {(SHORT)n, 1};
+            COORD origin = {0, 0};
+            SMALL_RECT region = {(SHORT)x, (SHORT)y, (SHORT)(x + n - 1), (SHORT)y};
+
+            for (int i = 0; i < n; i++)
+            {
+                const __nconio_styledef *def = &__nconio_styles[cells[i].style];
+                buf[i].Attributes = NCONIO_ATTR(__nconio_to16(def->fg), __nconio_to16(def->bg));
+                if (cells[i].ch == __NCONIO_WIDETAIL)
+                {
+                    buf[i].Char.UnicodeChar = __nconio_win_wchar(__nconio_glyphcp(cells[i - 1].ch)); // A span never starts with a right half
+                    buf[i].Attributes |= COMMON_LVB_TRAILING_BYTE;
+                    continue;
+                }
+                buf[i].Char.UnicodeChar = cells[i].ch < 0x80 ? (WCHAR)cells[i].ch : __nconio_win_wchar(__nconio_glyphcp(cells[i].ch));
+                if (i + 1 < count && cells[i + 1].ch == __NCONIO_WIDETAIL)
+                {
+                    buf[i].Attributes |= COMMON_LVB_LEADING_BYTE;
+                }
+            }
+            WriteConsoleOutputW(hConsole, buf, size, origin, &region);
+            __NCONIO_COUNT(writes, 1);
+            __NCONIO_COUNT(emitted, n);
+
+            cells += n;
+            count -= n;
+            x += n;
+        }
+    }
+
+    void putstrat(const char *str, int x, int y)
+    {
+        putrow(str, NULL, (int)strlen(str), x, y);
+    }
+
+    void putrect(const char *chars, const unsigned char *attrs, int w, int h, int stride, int x, int y)
+    {
+        for (int row = 0; row < h; row++)
+        {
+            putrow(chars + (size_t)row * stride, attrs ? attrs + (size_t)row * stride : NULL, w, x, y + row);
+        }
+    }
+
+    int wherex(void)
+    {
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+
+        if (GetConsoleScreenBufferInfo(hConsole, &csbi))
+        {
+            // Subtracting the starting X coordinate to get the relative position
+            return csbi.dwCursorPosition.X; // Return the X coordinate
+        }
+        return -1; // Return -1 on error
+    }
+
+    int wherey(void)
+    {
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+
+        if (GetConsoleScreenBufferInfo(hConsole, &csbi))
+        {
+            // Subtracting the starting Y coordinate to get the relative position
+            return csbi.dwCursorPosition.Y; // Return the Y coordinate
+        }
+        return -1; // Return -1 on error
+    }
+
+    void textcolor(int color)
+    {
+        // Map conio.h colors to Windows console foreground colors
+        WORD winColor = 0;
+        if (color > NCONIO_WHITE && __nconio_validcolor(color))
+        {
+            color = __nconio_to16(color); // The console has 16 colors only
+        }
+        switch (color)
+        {
+        case NCONIO_BLACK:
+            winColor = 0;
+            break;
+        case NCONIO_BLUE:
+            winColor = FOREGROUND_BLUE;
+            break;
+        case NCONIO_GREEN:
+            winColor = FOREGROUND_GREEN;
+            break;
+        case NCONIO_CYAN:
+            winColor = FOREGROUND_GREEN | FOREGROUND_BLUE;
+            break;
+        case NCONIO_RED:
+            winColor = FOREGROUND_RED;
+            break;
+        case NCONIO_MAGENTA:
+            winColor = FOREGROUND_RED | FOREGROUND_BLUE;
+            break;
+        case NCONIO_BROWN:
+            winColor = FOREGROUND_RED | FOREGROUND_GREEN;
+            break;
+        case NCONIO_LIGHTGRAY:
+            winColor = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
+            break;
+        case NCONIO_DARKGRAY:
+            winColor = FOREGROUND_INTENSITY;
+            break;
+        case NCONIO_LIGHTBLUE:
+            winColor = FOREGROUND_BLUE | FOREGROUND_INTENSITY;
+            break;
+        case NCONIO_LIGHTGREEN:
+            winColor = FOREGROUND_GREEN | FOREGROUND_INTENSITY;
+            break;
+        case NCONIO_LIGHTCYAN:
+            winColor = FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY;
+            break;
+        case NCONIO_LIGHTRED:
+            winColor = FOREGROUND_RED | FOREGROUND_INTENSITY;
+            break;
+        case NCONIO_LIGHTMAGENTA:
+            winColor = FOREGROUND_RED | FOREGROUND_BLUE | FOREGROUND_INTENSITY;
+            break;
+        case NCONIO_YELLOW:
+            winColor = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY;
+            break;
+        case NCONIO_WHITE:
+            winColor = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY;
+            break;
+        // Default to light gray if an unknown color is specified
+        default:
+            winColor = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
+            break;
+        }
+
+        // Apply only the foreground bits, preserving the background
+        __nconio_win_setattributes((__nconio_currentAttributes & 0xFFF0) | winColor);
+
+        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+        SetConsoleTextAttribute(hConsole, __nconio_currentAttributes);
+        __NCONIO_COUNT(attrs, 1);
+    }
+
+    void textbackground(int color)
+    {
+        // Map conio.h colors to Windows console background colors
+        WORD winColor = 0;
+        if (color > NCONIO_WHITE && __nconio_validcolor(color))
+        {
+            color = __nconio_to16(color); // The console has 16 colors only
+        }
+        switch (color)
+        {
+        case NCONIO_BLACK:
+            winColor = 0;
+            break;
+        case NCONIO_BLUE:
+            winColor = BACKGROUND_BLUE;
+            break;
+        case NCONIO_GREEN:
+            winColor = BACKGROUND_GREEN;
+            break;
+        case NCONIO_CYAN:
+            winColor = BACKGROUND_GREEN | BACKGROUND_BLUE;
+            break;
+        case NCONIO_RED:
+            winColor = BACKGROUND_RED;
+            break;
+        case NCONIO_MAGENTA:
+            winColor = BACKGROUND_RED | BACKGROUND_BLUE;
+            break;
+        case NCONIO_BROWN: // There's no direct brown color in background attributes; using yellow instead
+            winColor = BACKGROUND_RED | BACKGROUND_GREEN;
+            break;
+        case NCONIO_LIGHTGRAY:
+            winColor = BACKGROUND_RED | BACKGROUND_GREEN | BACKGROUND_BLUE;
+            break;
+        case NCONIO_DARKGRAY:
+            winColor = BACKGROUND_INTENSITY;
+            break;
+        case NCONIO_LIGHTBLUE:
+            winColor = BACKGROUND_BLUE | BACKGROUND_INTENSITY;
+            break;
+        case NCONIO_LIGHTGREEN:
+            winColor = BACKGROUND_GREEN | BACKGROUND_INTENSITY;
+            break;
+        case NCONIO_LIGHTCYAN:
+            winColor = BACKGROUND_GREEN | BACKGROUND_BLUE | BACKGROUND_INTENSITY;
+            break;
+        case NCONIO_LIGHTRED:
+            winColor = BACKGROUND_RED | BACKGROUND_INTENSITY;
+            break;
+        case NCONIO_LIGHTMAGENTA:
+            winColor = BACKGROUND_RED | BACKGROUND_BLUE | BACKGROUND_INTENSITY;
+            break;
+        case NCONIO_YELLOW:
+            winColor = BACKGROUND_RED | BACKGROUND_GREEN | BACKGROUND_INTENSITY;
+            break;
+        case NCONIO_WHITE:
+            winColor = BACKGROUND_RED | BACKGROUND_GREEN | BACKGROUND_BLUE | BACKGROUND_INTENSITY;
+            break;
+        // Default to no background color (black) if an unknown color is specified
+        default:
+            winColor = 0;
+            break;
+        }
+
+        // Apply only the background bits, preserving the foreground
+        __nconio_win_setattributes((__nconio_currentAttributes & 0xFF0F) | winColor);
+
+        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+        SetConsoleTextAttribute(hConsole, __nconio_currentAttributes);
+        __NCONIO_COUNT(attrs, 1);
+    }
+
+    void textcolorreset()
+    {
+        textcolor(-1);
+    }
+
+    void textbackgroundreset()
+    {
+        textbackground(-1);
+    }
+
+    int conw(void)
+    {
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        int width;
+
+        // Get the handle to the standard output device (the console)
+        HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+
+        // Get the console screen buffer info
+        if (!GetConsoleScreenBufferInfo(hStdout, &csbi))
+        {
+            // Return a default value if the function call fails
+            width = 80; // Default width
+        }
+        else
+        {
+            // Calculate the width
+            width = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+        }
+
+        return width;
+    }
+
+    int conh(void)
+    {
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        int height;
+
+        // Get the handle to the standard output device (the console)
+        HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+
+        // Get the console screen buffer info
+        if (!GetConsoleScreenBufferInfo(hStdout, &csbi))
+        {
+            // Return a default value if the function call fails
+            height = 25; // Default height
+        }
+        else
+        {
+            // Calculate the height
+            height = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+        }
+
+        return height;
+    }
+
+    int consizechanged(void)
+    {
+        static int prev_height = 0, prev_width = 0; // Previous dimensions
+
+        HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+
+        if (GetConsoleScreenBufferInfo(hStdout, &csbi))
+        {
+            int currentWidth = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+            int currentHeight = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+
+            if (currentWidth != prev_width || currentHeight != prev_height)
+            {
+                // Update last known dimensions
+                prev_width = currentWidth;
+                prev_height = currentHeight;
+                if (currentWidth != __nconio_w || currentHeight != __nconio_h)
+                {
+                    __nconio_win_loadscreen(); // Mirror the resized console
+                }
+                return 1; // True: Size has changed
+            }
+        }
+        return 0; // False: Size has not changed
+    }
+
+    void hidecursor()
+    {
+        HANDLE consoleHandle = GetStdHandle(STD_OUTPUT_HANDLE);
+        CONSOLE_CURSOR_INFO info;
+        info.dwSize = 100;     // The size of the cursor, from 1 to 100. The default size is 25.
+        info.bVisible = FALSE; // Hide the cursor
+        SetConsoleCursorInfo(consoleHandle, &info);
+    }
+
+    void showcursor()
+    {
+        HANDLE consoleHandle = GetStdHandle(STD_OUTPUT_HANDLE);
+        CONSOLE_CURSOR_INFO info;
+        info.dwSize = 100;    // The size of the cursor, from 1 to 100. The default size is 25.
+        info.bVisible = TRUE; // Hide the cursor
+        SetConsoleCursorInfo(consoleHandle, &info);
+    }
+
+#elif defined(__linux__) || (defined(__APPLE__) && defined(__MACH__))
+// ##################################################################
+//    Linux
+// ##################################################################
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <time.h>
+#if defined(__linux__)
+#include <sys/timerfd.h>
+#endif
+#ifdef NCONIO_THREADS
+#include <pthread.h>
+#endif
+
+// ------------------------------------------------------------------
+//    Linux: raw terminal mode, shared by both backends
+// ------------------------------------------------------------------
+
+static struct termios __nconio_termios; // Terminal mode before nconioinit
+static int __nconio_rawactive = 0;
+static int __nconio_stdoutflags = -1; // File status flags of stdout while nconio made it non-blocking
+static char __nconio_leaveseq[128]; // Puts the terminal back on screen, written when the process dies
+static size_t __nconio_leavelen = 0;
+static const int __nconio_fatalsignals[] = {SIGTERM, SIGHUP, SIGQUIT, SIGABRT, SIGSEGV, SIGBUS, SIGFPE, SIGILL};
+#define __NCONIO_FATALSIGNALS (int)(sizeof(__nconio_fatalsignals) / sizeof(__nconio_fatalsignals[0]))
+static void (*__nconio_oldhandlers[sizeof(__nconio_fatalsignals) / sizeof(__nconio_fatalsignals[0])])(int);
+static int __nconio_handled[sizeof(__nconio_fatalsignals) / sizeof(__nconio_fatalsignals[0])];
+
+// Add a terminal string to what is written when the process dies
+static void __nconio_addleaveseq(const char *seq)
+{
+    size_t len = seq ? strlen(seq) : 0;
+    if (len > 0 && __nconio_leavelen + len <= sizeof(__nconio_leaveseq))
+    {
+        memcpy(__nconio_leaveseq + __nconio_leavelen, seq, len);
+        __nconio_leavelen += len;
+    }
+}
+
+// Put the terminal back the way nconioinit found it. Only uses calls that
+// are safe inside a signal handler.
+static void __nconio_restoreterminal(void)
+{
+    if (__nconio_stdoutflags >= 0)
+    {
+        fcntl(STDOUT_FILENO, F_SETFL, __nconio_stdoutflags); // Writes block again (see nconio_setoutputlimit)
+        __nconio_stdoutflags = -1;
+    }
+    if (!__nconio_rawactive)
+    {
+        return;
+    }
+    __nconio_rawactive = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &__nconio_termios);
+}
+
+static void __nconio_fatalsignal(int sig)
+{
+    __nconio_restoreterminal();
+    ssize_t written = write(STDOUT_FILENO, __nconio_leaveseq, __nconio_leavelen);
+    (void)written;
+
+    // Die the way the process would have without nconio
+    for (int i = 0; i < __NCONIO_FATALSIGNALS; ++i)
+    {
+        if (__nconio_fatalsignals[i] == sig)
+        {
+            signal(sig, __nconio_oldhandlers[i]);
+        }
+    }
+    raise(sig);
+}
+
+// Switch the terminal to raw input once, for the whole session: keys arrive
+// byte by byte without echo and a key read is a single read()
+static void __nconio_rawmode(void)
+{
+    struct termios raw;
+
+    __nconio_leavelen = 0;
+    if (tcgetattr(STDIN_FILENO, &__nconio_termios) != 0)
+    {
+        return; // Input is not a terminal
+    }
+    raw = __nconio_termios;
+    raw.c_iflag &= ~(IXON | ICRNL | INLCR | IGNCR | ISTRIP); // Ctrl-S, Ctrl-Q and Enter reach the app as typed
+    raw.c_lflag &= ~(ICANON | ECHO | IEXTEN);                // No line buffering, echo or Ctrl-V
+    raw.c_cc[VMIN] = 1;                                      // read() returns as soon as there is a byte
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    __nconio_rawactive = 1;
+
+    // A crash or kill must not leave the shell in raw mode. Signals the app
+    // handles or ignores itself are left alone.
+    for (int i = 0; i < __NCONIO_FATALSIGNALS; ++i)
+    {
+        __nconio_oldhandlers[i] = signal(__nconio_fatalsignals[i], __nconio_fatalsignal);
+        __nconio_handled[i] = __nconio_oldhandlers[i] == SIG_DFL;
+        if (!__nconio_handled[i] && __nconio_oldhandlers[i] != SIG_ERR)
+        {
+            signal(__nconio_fatalsignals[i], __nconio_oldhandlers[i]);
+        }
+    }
+    signal(SIGINT, SIG_IGN); // Ignore Ctrl-C
+}
+
+// Leave raw mode and take the signal handlers back out
+static void __nconio_cookedmode(void)
+{
+    for (int i = 0; i < __NCONIO_FATALSIGNALS; ++i)
+    {
+        if (__nconio_handled[i])
+        {
+            signal(__nconio_fatalsignals[i], __nconio_oldhandlers[i]);
+            __nconio_handled[i] = 0;
+        }
+    }
+    signal(SIGINT, SIG_DFL); // Restore default Ctrl-C behavior
+    __nconio_restoreterminal();
+}
+
+// ------------------------------------------------------------------
+//    Linux: event sources of nconio_wait, shared by both backends
+// ------------------------------------------------------------------
+
+static int __nconio_wakefd[2] = {-1, -1};        // SIGWINCH writes a byte into this pipe to wake nconio_wait
+static volatile sig_atomic_t __nconio_resized = 0; // Set by SIGWINCH, the screen model is resized at the next flush
+static int __nconio_sizechanged = 0;               // The screen model was resized since the last consizechanged
+static void (*__nconio_oldwinch)(int) = SIG_DFL; // SIGWINCH handler before nconioinit, e.g. the one of ncurses
+#ifdef CLOCK_MONOTONIC
+#define __NCONIO_CLOCK CLOCK_MONOTONIC
+#else
+// Strict C modes hide CLOCK_MONOTONIC and clock_gettime, the C library has both all the same
+#if defined(__linux__)
+#define __NCONIO_CLOCK 1
+#else
+#define __NCONIO_CLOCK 6
+#endif
+int clock_gettime(int clock, struct timespec *ts); // clockid_t is an int as well
+#endif
+#if defined(__linux__)
+static int __nconio_timerfd = -1; // timerfd of nconio_settimer
+#else
+static long long __nconio_timerdue = 0; // Time of the next timer tick in microseconds
+static int __nconio_timerms = 0;        // Timer interval, 0 if the timer is off
+#endif
+
+static long long __nconio_now(void)
+{
+    struct timespec ts;
+    clock_gettime(__NCONIO_CLOCK, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void __nconio_sleep(long long us)
+{
+    if (us > 0)
+    {
+        poll(NULL, 0, (int)((us + 999) / 1000));
+    }
+}
+
+static void __nconio_winch(int sig)
+{
+    int saved = errno;
+    char byte = 0;
+    __nconio_resized = 1;
+    ssize_t written = write(__nconio_wakefd[1], &byte, 1); // If the pipe is full a wake up is pending anyway
+    (void)written;
+    if (__nconio_oldwinch != SIG_DFL && __nconio_oldwinch != SIG_IGN && __nconio_oldwinch != SIG_ERR)
+    {
+        __nconio_oldwinch(sig);
+    }
+    errno = saved;
+}
+
+// Open the resize notification pipe. Called after the backend is set up so
+// its own SIGWINCH handler (ncurses has one) keeps being called.
+static void __nconio_openwait(void)
+{
+    if (pipe(__nconio_wakefd) != 0)
+    {
+        __nconio_wakefd[0] = -1;
+        __nconio_wakefd[1] = -1;
+        return;
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        fcntl(__nconio_wakefd[i], F_SETFL, fcntl(__nconio_wakefd[i], F_GETFL) | O_NONBLOCK);
+        fcntl(__nconio_wakefd[i], F_SETFD, FD_CLOEXEC);
+    }
+    __nconio_resized = 0;
+    __nconio_sizechanged = 1; // The first consizechanged reports the initial size
+    __nconio_oldwinch = signal(SIGWINCH, __nconio_winch);
+}
+
+// Size of the terminal, TIOCGWINSZ is what both backends go by
+static void __nconio_termsize(int *w, int *h)
+{
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && ws.ws_row > 0)
+    {
+        *w = ws.ws_col;
+        *h = ws.ws_row;
+    }
+    else
+    {
+        *w = 80; // Default width
+        *h = 25; // Default height
+    }
+}
+
+// Implemented per backend: resize the screen model if SIGWINCH came in
+static void __nconio_checkresize(void);
+
+// Implemented per backend: the file descriptor output waits to be written to,
+// -1 if none, and what to do when it can take more (see nconio_setoutputlimit)
+static int __nconio_outputfd(void);
+static void __nconio_outputready(void);
+
+static void __nconio_closewait(void)
+{
+    if (__nconio_wakefd[0] >= 0)
+    {
+        signal(SIGWINCH, __nconio_oldwinch == SIG_ERR ? SIG_DFL : __nconio_oldwinch);
+        close(__nconio_wakefd[0]);
+        close(__nconio_wakefd[1]);
+        __nconio_wakefd[0] = -1;
+        __nconio_wakefd[1] = -1;
+    }
+#if defined(__linux__)
+    if (__nconio_timerfd >= 0)
+    {
+        close(__nconio_timerfd);
+        __nconio_timerfd = -1;
+    }
+#else
+    __nconio_timerms = 0;
+#endif
+}
+
+#ifdef NCONIO_THREADS
+// ------------------------------------------------------------------
+//    Linux: render thread, shared by both backends
+// ------------------------------------------------------------------
+
+// A queued call, followed by len bytes of data and padding to 8 bytes
+typedef struct __nconio_rtcall
+{
+    int op; // __NCONIO_RT_ call, -1 to continue at the start of the ring
+    int a, b, c, d;
+    int len;
+} __nconio_rtcall;
+
+static pthread_t __nconio_rt_thread;
+static int __nconio_rt_running = 0;
+static int __nconio_rt_policy = NCONIO_RENDER_BLOCK;
+static char *__nconio_rt_ring = NULL; // Single producer, single consumer
+static size_t __nconio_rt_size = 0;   // A power of two
+static size_t __nconio_rt_head = 0;   // Bytes published by the drawing thread, only ever grows
+static size_t __nconio_rt_tail = 0;   // Bytes applied by the render thread, only ever grows
+static size_t __nconio_rt_wpos = 0;   // Bytes written by the drawing thread, published at the end of a frame
+static int __nconio_rt_depth = 0;     // Frame nesting of the queued calls
+static unsigned long __nconio_rt_skipped = 0; // Frames NCONIO_RENDER_COALESCE did not show
+static int __nconio_rt_stopping = 0;
+static int __nconio_rt_idle = 0; // The render thread waits for calls
+static int __nconio_rt_full = 0; // The drawing thread waits for room
+static int __nconio_rt_direct = 0;   // The drawing thread applies calls itself, see __nconio_rt_overflow
+static int __nconio_rt_deferred = 0; // The drawing thread left a frame open for the render thread to show
+static unsigned long __nconio_rt_frames = 0; // Frames of the program applied since the last shown one
+static __nconio_cell __nconio_rt_tilecells[256]; // How the queued tiles are drawn (see nconio_drawtilemap)
+static pthread_mutex_t __nconio_rt_waitlock = PTHREAD_MUTEX_INITIALIZER;  // Only to sleep and wake up
+static pthread_cond_t __nconio_rt_wake = PTHREAD_COND_INITIALIZER;        // Calls were published
+static pthread_cond_t __nconio_rt_room = PTHREAD_COND_INITIALIZER;        // Calls were applied
+static pthread_mutex_t __nconio_rt_statelock = PTHREAD_MUTEX_INITIALIZER; // Held while the render thread draws
+
+static int __nconio_rt_active(void)
+{
+    return __nconio_rt_running && !__nconio_rt_direct && !pthread_equal(pthread_self(), __nconio_rt_thread);
+}
+
+static void __nconio_rt_lock(void)
+{
+    if (__nconio_rt_active())
+    {
+        pthread_mutex_lock(&__nconio_rt_statelock);
+    }
+}
+
+static void __nconio_rt_unlock(void)
+{
+    if (__nconio_rt_active())
+    {
+        pthread_mutex_unlock(&__nconio_rt_statelock);
+    }
+}
+
+// Wake a thread that sleeps on cond, if flag says it does. The flag is set before
+// the sleeper checks the ring a last time, so either it sees the change or we see it.
+static void __nconio_rt_signal(int *flag, pthread_cond_t *cond)
+{
+    if (__atomic_load_n(flag, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&__nconio_rt_waitlock);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(&__nconio_rt_waitlock);
+    }
+}
+
+static void __nconio_rt_publish(void)
+{
+    __atomic_store_n(&__nconio_rt_head, __nconio_rt_wpos, __ATOMIC_SEQ_CST);
+    __nconio_rt_signal(&__nconio_rt_idle, &__nconio_rt_wake);
+}
+
+static void __nconio_rt_apply(const __nconio_rtcall *call);
+
+// Apply the calls queued up to head, with the state lock held
+static void __nconio_rt_applyqueued(size_t head)
+{
+    size_t tail = __nconio_rt_tail;
+
+    while (tail != head)
+    {
+        size_t pos = tail & (__nconio_rt_size - 1);
+        const __nconio_rtcall *call = (const __nconio_rtcall *)(__nconio_rt_ring + pos);
+
+        if (__nconio_rt_size - pos < sizeof(__nconio_rtcall) || call->op < 0)
+        {
+            tail += __nconio_rt_size - pos; // The next call starts at the beginning
+            continue;
+        }
+        if (call->op == __NCONIO_RT_ENDFRAME && __nconio_frame_depth == 2)
+        {
+            __nconio_rt_frames++; // Closes a frame of the program inside the one NCONIO_RENDER_COALESCE opened
+        }
+        __nconio_rt_apply(call);
+        tail += sizeof(__nconio_rtcall) + (((size_t)call->len + 7) & ~(size_t)7);
+        __atomic_store_n(&__nconio_rt_tail, tail, __ATOMIC_SEQ_CST);
+        __nconio_rt_signal(&__nconio_rt_full, &__nconio_rt_room);
+    }
+}
+
+// NCONIO_RENDER_COALESCE with a full ring: rather than wait for the render thread,
+// which may be stuck in a write to a slow terminal, apply everything queued to
+// the screen model here. The frame opened for it stays open, so nothing is sent
+// from this thread; the render thread closes it and shows the result.
+static void __nconio_rt_overflow(void)
+{
+    pthread_mutex_lock(&__nconio_rt_statelock);
+    __nconio_rt_direct = 1;
+    if (!__nconio_rt_deferred)
+    {
+        nconio_beginframe();
+        __atomic_store_n(&__nconio_rt_deferred, 1, __ATOMIC_RELEASE);
+    }
+    __nconio_rt_applyqueued(__nconio_rt_wpos);
+    __atomic_store_n(&__nconio_rt_head, __nconio_rt_wpos, __ATOMIC_SEQ_CST);
+    __nconio_rt_direct = 0;
+    pthread_mutex_unlock(&__nconio_rt_statelock);
+    __nconio_rt_signal(&__nconio_rt_idle, &__nconio_rt_wake);
+}
+
+static char *__nconio_rt_begin(int op, int a, int b, int c, int d, int len)
+{
+    size_t need = sizeof(__nconio_rtcall) + (((size_t)len + 7) & ~(size_t)7);
+
+    if (op == __NCONIO_RT_BEGINFRAME)
+    {
+        __nconio_rt_depth++;
+    }
+    else if (op == __NCONIO_RT_ENDFRAME && __nconio_rt_depth > 0)
+    {
+        __nconio_rt_depth--;
+    }
+
+    for (;;)
+    {
+        size_t pos = __nconio_rt_wpos & (__nconio_rt_size - 1);
+        size_t skip = __nconio_rt_size - pos < need ? __nconio_rt_size - pos : 0; // A call is never split
+        size_t used = __nconio_rt_wpos - __atomic_load_n(&__nconio_rt_tail, __ATOMIC_ACQUIRE);
+
+        if (used + skip + need <= __nconio_rt_size)
+        {
+            if (skip >= sizeof(__nconio_rtcall))
+            {
+                ((__nconio_rtcall *)(__nconio_rt_ring + pos))->op = -1;
+            }
+            __nconio_rt_wpos += skip;
+
+            __nconio_rtcall *call = (__nconio_rtcall *)(__nconio_rt_ring + (__nconio_rt_wpos & (__nconio_rt_size - 1)));
+            call->op = op;
+            call->a = a;
+            call->b = b;
+            call->c = c;
+            call->d = d;
+            call->len = len;
+            __nconio_rt_wpos += need;
+            return (char *)(call + 1);
+        }
+
+        if (skip + need > __nconio_rt_size)
+        {
+            return NULL; // Never fits, only a row longer than the ring could ask for that
+        }
+        // Calls are never dropped: a program that draws only what changed would
+        // lose cells for good
+        if (__nconio_rt_policy == NCONIO_RENDER_COALESCE)
+        {
+            __nconio_rt_overflow();
+            continue;
+        }
+        __nconio_rt_publish(); // Let the render thread start on what is there and wait for room
+        pthread_mutex_lock(&__nconio_rt_waitlock);
+        __atomic_store_n(&__nconio_rt_full, 1, __ATOMIC_SEQ_CST);
+        if (__nconio_rt_wpos - __atomic_load_n(&__nconio_rt_tail, __ATOMIC_SEQ_CST) + skip + need > __nconio_rt_size)
+        {
+            pthread_cond_wait(&__nconio_rt_room, &__nconio_rt_waitlock);
+        }
+        __atomic_store_n(&__nconio_rt_full, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&__nconio_rt_waitlock);
+    }
+}
+
+// Calls are published when no frame is open, so the render thread sees whole frames
+static void __nconio_rt_end(void)
+{
+    if (__nconio_rt_depth == 0)
+    {
+        __nconio_rt_publish();
+    }
+}
+
+static void __nconio_rt_push(int op, int a, int b, int c, int d, const void *data, int len)
+{
+    char *buf = __nconio_rt_begin(op, a, b, c, d, len);
+    if (buf)
+    {
+        if (len > 0)
+        {
+            memcpy(buf, data, (size_t)len);
+        }
+        __nconio_rt_end();
+    }
+}
+
+static void __nconio_rt_apply(const __nconio_rtcall *call)
+{
+    const char *data = (const char *)(call + 1);
+    nconio_surface *surface = NULL;
+
+    if (call->op >= __NCONIO_RT_SETTARGET)
+    {
+        memcpy(&surface, data, sizeof(surface));
+    }
+
+    switch (call->op)
+    {
+    case __NCONIO_RT_PUTCHR:
+        putchr(call->a);
+        break;
+    case __NCONIO_RT_PUTCHAT:
+        putchat((char)call->a, call->b, call->c);
+        break;
+    case __NCONIO_RT_PUTROW:
+        putrow(data, call->d ? (const unsigned char *)data + call->a : NULL, call->a, call->b, call->c);
+        break;
+    case __NCONIO_RT_GOTOXY:
+        gotoxy(call->a, call->b);
+        break;
+    case __NCONIO_RT_CLRSCR:
+        clrscr();
+        break;
+    case __NCONIO_RT_TEXTCOLOR:
+        textcolor(call->a);
+        break;
+    case __NCONIO_RT_TEXTBACKGROUND:
+        textbackground(call->a);
+        break;
+    case __NCONIO_RT_SETSTYLE:
+        nconio_setstyle(call->a);
+        break;
+    case __NCONIO_RT_HIDECURSOR:
+        hidecursor();
+        break;
+    case __NCONIO_RT_SHOWCURSOR:
+        showcursor();
+        break;
+    case __NCONIO_RT_BEGINFRAME:
+        nconio_beginframe();
+        break;
+    case __NCONIO_RT_ENDFRAME:
+        nconio_endframe();
+        break;
+    case __NCONIO_RT_FLUSH:
+        if (__nconio_rt_policy == NCONIO_RENDER_BLOCK)
+        {
+            nconio_flush(); // Coalesced calls are flushed together
+        }
+        break;
+    case __NCONIO_RT_SETFLUSHMODE:
+        nconio_setflushmode(call->a);
+        break;
+    case __NCONIO_RT_SYNCINPUT:
+        __nconio_syncinput();
+        break;
+    case __NCONIO_RT_PUTCP:
+        nconio_putcp((unsigned int)call->a, call->b, call->c);
+        break;
+    case __NCONIO_RT_PUTUTF8:
+        nconio_pututf8(data, call->a, call->b); // Queued with its '\0'
+        break;
+    case __NCONIO_RT_TILELOOKS:
+        __nconio_tilecells((const __nconio_tilelook *)data, __nconio_rt_tilecells);
+        break;
+    case __NCONIO_RT_PUTTILES:
+        __nconio_puttiles((const unsigned char *)data, __nconio_rt_tilecells, call->a, call->b, call->c);
+        if (call->d)
+        {
+            __nconio_touch();
+        }
+        break;
+    case __NCONIO_RT_SETTARGET:
+        nconio_settarget(surface);
+        break;
+    case __NCONIO_RT_MOVESURFACE:
+        nconio_movesurface(surface, call->a, call->b);
+        break;
+    case __NCONIO_RT_SHOWSURFACE:
+        nconio_showsurface(surface, call->a);
+        break;
+    case __NCONIO_RT_FREESURFACE:
+        nconio_freesurface(surface);
+        break;
+    }
+}
+
+// Implemented per backend: write the output of the last calls the render thread
+// applied. It is called without the state lock, so that calls that read the
+// state do not wait for the terminal.
+static void __nconio_writeheld(void);
+
+static void *__nconio_rt_main(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        size_t head = __atomic_load_n(&__nconio_rt_head, __ATOMIC_ACQUIRE);
+
+        if (head == __atomic_load_n(&__nconio_rt_tail, __ATOMIC_ACQUIRE) && !__atomic_load_n(&__nconio_rt_deferred, __ATOMIC_ACQUIRE))
+        {
+            if (__atomic_load_n(&__nconio_rt_stopping, __ATOMIC_ACQUIRE))
+            {
+                return NULL;
+            }
+
+            // Output a slow terminal did not take yet is written here, a new call
+            // is noticed within a few milliseconds
+            pthread_mutex_lock(&__nconio_rt_statelock);
+            int fd = __nconio_outputfd();
+            pthread_mutex_unlock(&__nconio_rt_statelock);
+            if (fd >= 0)
+            {
+                struct pollfd pfd = {fd, POLLOUT, 0};
+                if (poll(&pfd, 1, 5) > 0)
+                {
+                    pthread_mutex_lock(&__nconio_rt_statelock);
+                    __nconio_outputready();
+                    pthread_mutex_unlock(&__nconio_rt_statelock);
+                    __nconio_writeheld();
+                }
+                continue;
+            }
+
+            pthread_mutex_lock(&__nconio_rt_waitlock);
+            __atomic_store_n(&__nconio_rt_idle, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&__nconio_rt_head, __ATOMIC_SEQ_CST) == __atomic_load_n(&__nconio_rt_tail, __ATOMIC_SEQ_CST) &&
+                !__atomic_load_n(&__nconio_rt_deferred, __ATOMIC_SEQ_CST) && !__atomic_load_n(&__nconio_rt_stopping, __ATOMIC_SEQ_CST))
+            {
+                pthread_cond_wait(&__nconio_rt_wake, &__nconio_rt_waitlock);
+            }
+            __atomic_store_n(&__nconio_rt_idle, 0, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&__nconio_rt_waitlock);
+            continue;
+        }
+
+        pthread_mutex_lock(&__nconio_rt_statelock);
+        head = __atomic_load_n(&__nconio_rt_head, __ATOMIC_ACQUIRE); // The drawing thread may have applied calls meanwhile
+        if (__nconio_rt_policy == NCONIO_RENDER_COALESCE && !__nconio_rt_deferred)
+        {
+            nconio_beginframe(); // Everything published so far reaches the terminal as one frame
+        }
+        __nconio_rt_applyqueued(head);
+        if (__nconio_rt_policy == NCONIO_RENDER_COALESCE)
+        {
+            __atomic_store_n(&__nconio_rt_deferred, 0, __ATOMIC_RELEASE);
+            nconio_endframe(); // Also closes the frame of __nconio_rt_overflow
+            if (__nconio_rt_frames > 1)
+            {
+                __atomic_fetch_add(&__nconio_rt_skipped, __nconio_rt_frames - 1, __ATOMIC_RELAXED);
+            }
+            __nconio_rt_frames = 0;
+        }
+        pthread_mutex_unlock(&__nconio_rt_statelock);
+        __nconio_writeheld();
+    }
+}
+
+int nconio_startrender(int queue_kb, int policy)
+{
+    size_t size = 65536;
+    size_t want = (size_t)(queue_kb > 0 ? queue_kb : 1024) * 1024;
+
+    if (__nconio_rt_running)
+    {
+        return 0;
+    }
+    while (size < want)
+    {
+        size *= 2;
+    }
+    __nconio_rt_ring = (char *)malloc(size);
+    if (__nconio_rt_ring == NULL)
+    {
+        return 0;
+    }
+    __nconio_rt_size = size;
+    __nconio_rt_policy = policy == NCONIO_RENDER_COALESCE ? NCONIO_RENDER_COALESCE : NCONIO_RENDER_BLOCK;
+    __nconio_rt_head = 0;
+    __nconio_rt_tail = 0;
+    __nconio_rt_wpos = 0;
+    __nconio_rt_depth = 0;
+    __nconio_rt_skipped = 0;
+    __nconio_rt_frames = 0;
+    __nconio_rt_deferred = 0;
+    __nconio_rt_stopping = 0;
+
+    // Set before the thread starts, so it knows it is the render thread
+    __nconio_rt_running = 1;
+    if (pthread_create(&__nconio_rt_thread, NULL, __nconio_rt_main, NULL) != 0)
+    {
+        __nconio_rt_running = 0;
+        free(__nconio_rt_ring);
+        __nconio_rt_ring = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+void nconio_stoprender(void)
+{
+    if (!__nconio_rt_active())
+    {
+        return;
+    }
+
+    // An unfinished frame is drawn as far as it got
+    __nconio_rt_publish();
+    __atomic_store_n(&__nconio_rt_stopping, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&__nconio_rt_waitlock);
+    pthread_cond_signal(&__nconio_rt_wake);
+    pthread_mutex_unlock(&__nconio_rt_waitlock);
+    pthread_join(__nconio_rt_thread, NULL);
+
+    __nconio_rt_running = 0;
+    free(__nconio_rt_ring);
+    __nconio_rt_ring = NULL;
+}
+
+unsigned long nconio_droppedframes(void)
+{
+    return __atomic_load_n(&__nconio_rt_skipped, __ATOMIC_RELAXED);
+}
+#endif // NCONIO_THREADS
+
+#ifdef NCONIO_VT
+// ------------------------------------------------------------------
+//    Linux: native VT backend (define NCONIO_VT, no ncurses needed)
+// ------------------------------------------------------------------
+
+#define __NCONIO_VT_OUTSIZE (1 << 16) // Initial size of the output buffer
+
+static char *__nconio_vt_out = NULL; // Output collected until the next flush
+static size_t __nconio_vt_outlen = 0;
+static size_t __nconio_vt_outcap = 0;
+static unsigned long __nconio_vt_written = 0; // Bytes written since the last present
+static int __nconio_vt_x = -1;                // Cursor position on the terminal, -1 if unknown
+static int __nconio_vt_y = -1;
+static int __nconio_vt_style = -1; // Style last sent to the terminal, -1 if unknown
+static size_t __nconio_vt_limit = 0;  // Bytes a flush sends with non-blocking writes, 0 writes blocking
+static size_t __nconio_vt_unsent = 0; // Bytes at the start of the output an earlier flush could not send
+#ifdef NCONIO_THREADS
+static char *__nconio_vt_held = NULL; // Output the render thread writes once it released the state lock
+static size_t __nconio_vt_heldlen = 0;
+static size_t __nconio_vt_heldcap = 0;
+#endif
+static int __nconio_vt_rep = 0;       // The terminal repeats characters (REP)
+
+// ------------------------------------------------------------------
+//    Linux: headless terminal (see nconio_initheadless)
+// ------------------------------------------------------------------
+
+static int __nconio_headless = 0;                 // Output goes to the in-memory terminal instead of stdout
+static nconio_vtcell *__nconio_hl_cells = NULL;   // What the in-memory terminal shows
+static int __nconio_hl_w = 0;                     // Size of the in-memory terminal
+static int __nconio_hl_h = 0;
+static int __nconio_hl_x = 0;                     // Cursor position
+static int __nconio_hl_y = 0;
+static int __nconio_hl_wrap = 0;                  // The last column was written, the next character wraps
+static int __nconio_hl_top = 0;                   // Scroll region, rows top to bottom inclusive
+static int __nconio_hl_bottom = 0;
+static int __nconio_hl_cursor = 1;                // Cursor visible
+static nconio_vtcell __nconio_hl_pen = {' ', -1, -1, 0}; // Colors and attributes set by SGR
+static char __nconio_hl_seq[64];                  // Escape sequence split between two writes
+static int __nconio_hl_seqlen = 0;                // The buffer size while a sequence too long to keep is skipped
+static char __nconio_hl_utf8[4];                  // UTF-8 sequence split between two writes
+static int __nconio_hl_utf8len = 0;
+
+// A wide character loses both halves when one of them is overwritten
+static void __nconio_hl_unwide(int i)
+{
+    nconio_vtcell *cells = __nconio_hl_cells;
+    int x = i % __nconio_hl_w;
+
+    if (cells[i].ch == 0 && x > 0)
+    {
+        cells[i - 1].ch = ' ';
+    }
+    if (x < __nconio_hl_w - 1 && cells[i + 1].ch == 0)
+    {
+        cells[i + 1].ch = ' ';
+    }
+}
+
+static void __nconio_hl_erase(int from, int to)
+{
+    nconio_vtcell blank = {' ', __nconio_hl_pen.fg, __nconio_hl_pen.bg, 0}; // Erasing keeps the background
+    if (from < to)
+    {
+        __nconio_hl_unwide(from);
+        __nconio_hl_unwide(to - 1);
+    }
+    for (int i = from; i < to; i++)
+    {
+        __nconio_hl_cells[i] = blank;
+    }
+}
+
+// Scroll the rows top to bottom n rows up (n < 0 scrolls down)
+static void __nconio_hl_scroll(int top, int bottom, int n)
+{
+    int rows = bottom - top + 1;
+    size_t w = (size_t)__nconio_hl_w;
+
+    if (n >= rows || -n >= rows)
+    {
+        __nconio_hl_erase(top * __nconio_hl_w, (bottom + 1) * __nconio_hl_w);
+        return;
+    }
+    if (n > 0)
+    {
+        memmove(__nconio_hl_cells + top * w, __nconio_hl_cells + (top + n) * w, (size_t)(rows - n) * w * sizeof(nconio_vtcell));
+        __nconio_hl_erase((bottom + 1 - n) * __nconio_hl_w, (bottom + 1) * __nconio_hl_w);
+    }
+    else if (n < 0)
+    {
+        memmove(__nconio_hl_cells + (top - n) * w, __nconio_hl_cells + top * w, (size_t)(rows + n) * w * sizeof(nconio_vtcell));
+        __nconio_hl_erase(top * __nconio_hl_w, (top - n) * __nconio_hl_w);
+    }
+}
+
+// A wide character split between cells i - 1 and i of a row loses both halves
+static void __nconio_hl_split(int i)
+{
+    if (i % __nconio_hl_w > 0 && __nconio_hl_cells[i].ch == 0)
+    {
+        __nconio_hl_cells[i - 1].ch = ' ';
+        __nconio_hl_cells[i].ch = ' ';
+    }
+}
+
+// Shift the cells of the row starting at cell row, from column x on, n cells
+// right by inserting blanks (n < 0 deletes cells and shifts them left)
+static void __nconio_hl_shift(int row, int x, int n)
+{
+    nconio_vtcell blank = {' ', __nconio_hl_pen.fg, __nconio_hl_pen.bg, 0};
+    nconio_vtcell *cells = __nconio_hl_cells + row;
+    int w = __nconio_hl_w, count = n > 0 ? n : -n;
+
+    count = count < w - x ? count : w - x;
+    __nconio_hl_split(row + x);
+    if (n > 0)
+    {
+        __nconio_hl_split(row + w - count); // Cut off at the right edge
+        memmove(cells + x + count, cells + x, (size_t)(w - x - count) * sizeof(nconio_vtcell));
+    }
+    else
+    {
+        if (x + count < w)
+        {
+            __nconio_hl_split(row + x + count);
+        }
+        memmove(cells + x, cells + x + count, (size_t)(w - x - count) * sizeof(nconio_vtcell));
+        x = w - count;
+    }
+    for (int i = x; i < x + count; i++)
+    {
+        cells[i] = blank;
+    }
+}
+
+// Move the cursor a line down, scrolling at the bottom of the scroll region
+static void __nconio_hl_index(void)
+{
+    if (__nconio_hl_y == __nconio_hl_bottom)
+    {
+        __nconio_hl_scroll(__nconio_hl_top, __nconio_hl_bottom, 1);
+    }
+    else if (__nconio_hl_y < __nconio_hl_h - 1)
+    {
+        __nconio_hl_y++;
+    }
+}
+
+static void __nconio_hl_moveto(int x, int y)
+{
+    __nconio_hl_x = x < 0 ? 0 : x >= __nconio_hl_w ? __nconio_hl_w - 1 : x;
+    __nconio_hl_y = y < 0 ? 0 : y >= __nconio_hl_h ? __nconio_hl_h - 1 : y;
+    __nconio_hl_wrap = 0;
+}
+
+static void __nconio_hl_print(unsigned int cp)
+{
+    int width = nconio_cpwidth(cp);
+
+    if (width == 0)
+    {
+        return; // Combining marks are not tracked
+    }
+    if (__nconio_hl_wrap || (width == 2 && __nconio_hl_x == __nconio_hl_w - 1 && __nconio_hl_w > 1))
+    {
+        // A wide character that does not fit in the last column wraps first
+        __nconio_hl_x = 0;
+        __nconio_hl_index();
+        __nconio_hl_wrap = 0;
+    }
+    int i = __nconio_hl_y * __nconio_hl_w + __nconio_hl_x;
+    __nconio_hl_pen.ch = cp;
+    __nconio_hl_unwide(i);
+    __nconio_hl_cells[i] = __nconio_hl_pen;
+    if (width == 2 && __nconio_hl_x < __nconio_hl_w - 1)
+    {
+        __nconio_hl_x++;
+        __nconio_hl_unwide(i + 1);
+        __nconio_hl_cells[i + 1] = __nconio_hl_pen;
+        __nconio_hl_cells[i + 1].ch = 0;
+    }
+    if (__nconio_hl_x == __nconio_hl_w - 1)
+    {
+        __nconio_hl_wrap = 1;
+    }
+    else
+    {
+        __nconio_hl_x++;
+    }
+}
+
+// Color of an SGR color parameter at p (30-37, 90-97, 38;5;n, 38;2;r;g;b and
+// the background forms). Returns how many parameters it used.
+static int __nconio_hl_color(const int *p, int n, int base, int *color)
+{
+    if (p[0] == base + 8 && n >= 3 && p[1] == 5)
+    {
+        *color = NCONIO_COLOR256(p[2]);
+        return 3;
+    }
+    if (p[0] == base + 8 && n >= 5 && p[1] == 2)
+    {
+        *color = NCONIO_RGB(p[2], p[3], p[4]);
+        return 5;
+    }
+    if (p[0] == base + 9)
+    {
+        *color = -1;
+    }
+    else if (p[0] >= base && p[0] < base + 8)
+    {
+        *color = __nconio_ansi[p[0] - base];
+    }
+    else
+    {
+        *color = __nconio_ansi[p[0] - base - 60] + 8;
+    }
+    return 1;
+}
+
+static void __nconio_hl_sgr(const int *p, int n)
+{
+    if (n == 0)
+    {
+        n = 1; // ESC [ m is ESC [ 0 m
+    }
+    for (int i = 0; i < n;)
+    {
+        int v = p[i] < 0 ? 0 : p[i];
+        if (v == 0)
+        {
+            __nconio_hl_pen.fg = -1;
+            __nconio_hl_pen.bg = -1;
+            __nconio_hl_pen.attrs = 0;
+        }
+        else if (v == 1 || v == 22)
+        {
+            __nconio_hl_pen.attrs = v == 1 ? __nconio_hl_pen.attrs | NCONIO_BOLD : __nconio_hl_pen.attrs & ~NCONIO_BOLD;
+        }
+        else if (v == 4 || v == 24)
+        {
+            __nconio_hl_pen.attrs = v == 4 ? __nconio_hl_pen.attrs | NCONIO_UNDERLINE : __nconio_hl_pen.attrs & ~NCONIO_UNDERLINE;
+        }
+        else if (v == 7 || v == 27)
+        {
+            __nconio_hl_pen.attrs = v == 7 ? __nconio_hl_pen.attrs | NCONIO_REVERSE : __nconio_hl_pen.attrs & ~NCONIO_REVERSE;
+        }
+        else if ((v >= 30 && v <= 39) || (v >= 90 && v <= 97))
+        {
+            i += __nconio_hl_color(p + i, n - i, 30, &__nconio_hl_pen.fg);
+            continue;
+        }
+        else if ((v >= 40 && v <= 49) || (v >= 100 && v <= 107))
+        {
+            i += __nconio_hl_color(p + i, n - i, 40, &__nconio_hl_pen.bg);
+            continue;
+        }
+        i++;
+    }
+}
+
+// Carry out a CSI sequence. Parameters that were left out are -1.
+static void __nconio_hl_csi(char prefix, const int *p, int n, char final)
+{
+    int a = n > 0 && p[0] > 0 ? p[0] : 1; // First parameter where 0 and missing mean 1
+    int row = __nconio_hl_y * __nconio_hl_w;
+
+    if (prefix == '?')
+    {
+        if ((final == 'h' || final == 'l') && n > 0 && p[0] == 25)
+        {
+            __nconio_hl_cursor = final == 'h';
+        }
+        return; // Other private modes (like the alternate screen) change nothing that is tracked
+    }
+
+    switch (final)
+    {
+    case 'H':
+    case 'f':
+        __nconio_hl_moveto(n > 1 && p[1] > 0 ? p[1] - 1 : 0, a - 1);
+        break;
+    case 'A':
+        __nconio_hl_moveto(__nconio_hl_x, __nconio_hl_y - a);
+        break;
+    case 'B':
+        __nconio_hl_moveto(__nconio_hl_x, __nconio_hl_y + a);
+        break;
+    case 'C':
+        __nconio_hl_moveto(__nconio_hl_x + a, __nconio_hl_y);
+        break;
+    case 'D':
+        __nconio_hl_moveto(__nconio_hl_x - a, __nconio_hl_y);
+        break;
+    case 'G':
+        __nconio_hl_moveto(a - 1, __nconio_hl_y);
+        break;
+    case 'd':
+        __nconio_hl_moveto(__nconio_hl_x, a - 1);
+        break;
+    case 'J':
+        if (n == 0 || p[0] <= 0)
+        {
+            __nconio_hl_erase(row + __nconio_hl_x, __nconio_hl_w * __nconio_hl_h);
+        }
+        else if (p[0] == 1)
+        {
+            __nconio_hl_erase(0, row + __nconio_hl_x + 1);
+        }
+        else
+        {
+            __nconio_hl_erase(0, __nconio_hl_w * __nconio_hl_h);
+        }
+        break;
+    case 'K':
+        if (n == 0 || p[0] <= 0)
+        {
+            __nconio_hl_erase(row + __nconio_hl_x, row + __nconio_hl_w);
+        }
+        else if (p[0] == 1)
+        {
+            __nconio_hl_erase(row, row + __nconio_hl_x + 1);
+        }
+        else
+        {
+            __nconio_hl_erase(row, row + __nconio_hl_w);
+        }
+        break;
+    case 'X':
+        __nconio_hl_erase(row + __nconio_hl_x, row + (__nconio_hl_x + a < __nconio_hl_w ? __nconio_hl_x + a : __nconio_hl_w));
+        break;
+    case 'b':
+        // Repeat the last character printed
+        for (int i = 0; i < a; i++)
+        {
+            __nconio_hl_print(__nconio_hl_pen.ch);
+        }
+        break;
+    case 'm':
+        __nconio_hl_sgr(p, n);
+        break;
+    case 'r':
+    {
+        int top = n > 0 && p[0] > 0 ? p[0] - 1 : 0;
+        int bottom = n > 1 && p[1] > 0 ? p[1] - 1 : __nconio_hl_h - 1;
+        if (top < bottom && bottom < __nconio_hl_h)
+        {
+            __nconio_hl_top = top;
+            __nconio_hl_bottom = bottom;
+        }
+        __nconio_hl_moveto(0, 0);
+        break;
+    }
+    case 'S':
+        __nconio_hl_scroll(__nconio_hl_top, __nconio_hl_bottom, a);
+        break;
+    case 'T':
+        __nconio_hl_scroll(__nconio_hl_top, __nconio_hl_bottom, -a);
+        break;
+    case '@':
+    case 'P':
+        __nconio_hl_shift(row, __nconio_hl_x, final == '@' ? a : -a);
+        __nconio_hl_wrap = 0;
+        break;
+    case 'L':
+    case 'M':
+        if (__nconio_hl_y >= __nconio_hl_top && __nconio_hl_y <= __nconio_hl_bottom)
+        {
+            __nconio_hl_scroll(__nconio_hl_y, __nconio_hl_bottom, final == 'L' ? -a : a);
+            __nconio_hl_moveto(0, __nconio_hl_y);
+        }
+        break;
+    }
+}
+
+// Parse one escape sequence at s. Returns the bytes it used, 0 if it is not complete.
+static int __nconio_hl_escape(const char *s, int n)
+{
+    if (n < 2)
+    {
+        return 0;
+    }
+    switch (s[1])
+    {
+    case '[':
+    {
+        int p[16], count = 0, value = -1, i = 2;
+        char prefix = 0;
+        if (i < n && (s[i] == '?' || s[i] == '>' || s[i] == '='))
+        {
+            prefix = s[i++];
+        }
+        for (; i < n; i++)
+        {
+            if (s[i] >= '0' && s[i] <= '9')
+            {
+                value = (value < 0 ? 0 : value * 10) + s[i] - '0';
+            }
+            else if (s[i] == ';')
+            {
+                if (count < 16)
+                {
+                    p[count++] = value;
+                }
+                value = -1;
+            }
+            else
+            {
+                break;
+            }
+        }
+        if (i >= n)
+        {
+            return 0;
+        }
+        if ((value >= 0 || count > 0) && count < 16)
+        {
+            p[count++] = value;
+        }
+        __nconio_hl_csi(prefix, p, count, s[i]);
+        return i + 1;
+    }
+    case '(':
+    case ')':
+        return n < 3 ? 0 : 3; // Character set selection
+    case 'D':
+        __nconio_hl_index();
+        return 2;
+    case 'M':
+        // Reverse index: a line up, scrolling down at the top of the scroll region
+        if (__nconio_hl_y == __nconio_hl_top)
+        {
+            __nconio_hl_scroll(__nconio_hl_top, __nconio_hl_bottom, -1);
+        }
+        else if (__nconio_hl_y > 0)
+        {
+            __nconio_hl_y--;
+        }
+        return 2;
+    }
+    return 2; // Not tracked
+}
+
+// Skip the rest of an escape sequence too long to keep, up to its final byte.
+// Returns the bytes skipped.
+static size_t __nconio_hl_skipseq(const char *buf, size_t size)
+{
+    size_t i = 0;
+
+    while (i < size)
+    {
+        unsigned char ch = (unsigned char)buf[i++];
+        if (ch >= 0x40 && ch <= 0x7e)
+        {
+            __nconio_hl_seqlen = 0;
+            break;
+        }
+    }
+    return i;
+}
+
+// Run bytes nconio emitted through the in-memory terminal
+static void __nconio_hl_feed(const char *buf, size_t size)
+{
+    size_t i = 0;
+
+    // Finish a character or sequence the last write ended in the middle of
+    while (__nconio_hl_utf8len > 0 && i < size)
+    {
+        unsigned int cp;
+        __nconio_hl_utf8[__nconio_hl_utf8len++] = buf[i++];
+        int used = __nconio_utf8decode(__nconio_hl_utf8, __nconio_hl_utf8len, &cp);
+        if (used > 0)
+        {
+            __nconio_hl_print(cp);
+            if (used < __nconio_hl_utf8len && ((unsigned char)buf[i - 1] & 0xc0) != 0x80)
+            {
+                i--; // Cut the sequence short, read again on its own
+            }
+            __nconio_hl_utf8len = 0;
+        }
+    }
+    while (__nconio_hl_seqlen > 0 && i < size)
+    {
+        if (__nconio_hl_seqlen == (int)sizeof(__nconio_hl_seq))
+        {
+            i += __nconio_hl_skipseq(buf + i, size - i);
+        }
+        else
+        {
+            __nconio_hl_seq[__nconio_hl_seqlen++] = buf[i++];
+            if (__nconio_hl_escape(__nconio_hl_seq, __nconio_hl_seqlen) > 0)
+            {
+                __nconio_hl_seqlen = 0;
+            }
+        }
+    }
+
+    while (i < size)
+    {
+        unsigned char ch = (unsigned char)buf[i];
+        if (ch == 0x1b)
+        {
+            int left = size - i < sizeof(__nconio_hl_seq) ? (int)(size - i) : (int)sizeof(__nconio_hl_seq);
+            int used = __nconio_hl_escape(buf + i, left);
+            if (used == 0)
+            {
+                // Keep it for the next write. A full buffer means the sequence
+                // is too long to keep, the rest of it is skipped.
+                memcpy(__nconio_hl_seq, buf + i, (size_t)left);
+                __nconio_hl_seqlen = left;
+                i += (size_t)left;
+                i += __nconio_hl_skipseq(buf + i, size - i);
+                continue;
+            }
+            i += (size_t)used;
+            continue;
+        }
+        switch (ch)
+        {
+        case '\r':
+            __nconio_hl_moveto(0, __nconio_hl_y);
+            break;
+        case '\n':
+            __nconio_hl_index();
+            __nconio_hl_wrap = 0;
+            break;
+        case '\b':
+            __nconio_hl_moveto(__nconio_hl_x - 1, __nconio_hl_y);
+            break;
+        case '\t':
+            __nconio_hl_moveto((__nconio_hl_x / 8 + 1) * 8, __nconio_hl_y);
+            break;
+        default:
+            if (ch >= 0x80)
+            {
+                unsigned int cp;
+                int used = __nconio_utf8decode(buf + i, (int)(size - i < 4 ? size - i : 4), &cp);
+                if (used == 0)
+                {
+                    memcpy(__nconio_hl_utf8, buf + i, size - i);
+                    __nconio_hl_utf8len = (int)(size - i);
+                    return;
+                }
+                __nconio_hl_print(cp);
+                i += (size_t)used;
+                continue;
+            }
+            if (ch >= 0x20)
+            {
+                __nconio_hl_print(ch);
+            }
+            break;
+        }
+        i++;
+    }
+}
+
+static void __nconio_hl_free(void)
+{
+    free(__nconio_hl_cells);
+    __nconio_hl_cells = NULL;
+    __nconio_hl_w = 0;
+    __nconio_hl_h = 0;
+    __nconio_headless = 0;
+}
+
+static int __nconio_hl_alloc(int w, int h)
+{
+    nconio_vtcell *cells = (nconio_vtcell *)malloc((size_t)w * h * sizeof(nconio_vtcell));
+    if (cells == NULL)
+    {
+        return 0;
+    }
+
+    nconio_vtcell blank = {' ', -1, -1, 0};
+    for (size_t i = 0; i < (size_t)w * h; i++)
+    {
+        cells[i] = blank;
+    }
+    // A resize keeps the top left of what was shown, like a terminal window
+    for (int y = 0; y < h && y < __nconio_hl_h; y++)
+    {
+        memcpy(cells + (size_t)y * w, __nconio_hl_cells + (size_t)y * __nconio_hl_w, (size_t)(w < __nconio_hl_w ? w : __nconio_hl_w) * sizeof(nconio_vtcell));
+    }
+    free(__nconio_hl_cells);
+    __nconio_hl_cells = cells;
+    __nconio_hl_w = w;
+    __nconio_hl_h = h;
+    __nconio_hl_top = 0;
+    __nconio_hl_bottom = h - 1;
+    __nconio_hl_moveto(__nconio_hl_x, __nconio_hl_y);
+    return 1;
+}
+
+int nconio_headless_cell(int x, int y, nconio_vtcell *cell)
+{
+    int inside;
+
+    __nconio_rt_lock(); // The render thread writes to the terminal
+    inside = __nconio_headless && x >= 0 && y >= 0 && x < __nconio_hl_w && y < __nconio_hl_h;
+    if (inside && cell)
+    {
+        *cell = __nconio_hl_cells[y * __nconio_hl_w + x];
+    }
+    __nconio_rt_unlock();
+    return inside;
+}
+
+int nconio_headless_cursor(int *x, int *y)
+{
+    __nconio_rt_lock();
+    if (x)
+    {
+        *x = __nconio_hl_x;
+    }
+    if (y)
+    {
+        *y = __nconio_hl_y;
+    }
+    int visible = __nconio_hl_cursor;
+    __nconio_rt_unlock();
+    return visible;
+}
+
+void nconio_headless_input(const char *bytes, int count)
+{
+    while (__nconio_headless && count > 0)
+    {
+        int n = (int)sizeof(__nconio_inbuf) - __nconio_inlen;
+        n = count < n ? count : n;
+        memcpy(__nconio_inbuf + __nconio_inlen, bytes, (size_t)n);
+        __nconio_inlen += n;
+        bytes += n;
+        count -= n;
+        __nconio_decodeinput(1); // Scripted input is complete, a lone ESC is the Escape key
+    }
+}
+
+void nconio_headless_resize(int w, int h)
+{
+    __nconio_rt_lock();
+    int resized = __nconio_headless && w > 0 && h > 0 && __nconio_hl_alloc(w, h);
+    __nconio_rt_unlock();
+    if (!resized)
+    {
+        return;
+    }
+    // Delivered like a SIGWINCH
+    __nconio_resized = 1;
+    if (__nconio_wakefd[1] >= 0)
+    {
+        char byte = 0;
+        ssize_t written = write(__nconio_wakefd[1], &byte, 1);
+        (void)written;
+    }
+}
+
+// Size of the terminal nconio draws on
+static void __nconio_vt_getsize(int *w, int *h)
+{
+    if (__nconio_headless)
+    {
+        *w = __nconio_hl_w;
+        *h = __nconio_hl_h;
+        return;
+    }
+    __nconio_termsize(w, h);
+}
+
+// Write bytes to stdout, retrying on partial writes. Returns the bytes written
+// and adds the write calls it took to *calls.
+static size_t __nconio_vt_writeall(const char *buf, size_t size, int *calls)
+{
+    size_t done = 0;
+
+    while (done < size)
+    {
+        ssize_t n = write(STDOUT_FILENO, buf + done, size - done);
+        (*calls)++;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                struct pollfd pfd = {STDOUT_FILENO, POLLOUT, 0}; // Non-blocking, wait here anyway
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            break;
+        }
+        done += (size_t)n;
+    }
+    return done;
+}
+
+// Write bytes to the terminal
+static void __nconio_vt_write(const char *buf, size_t size)
+{
+    int calls = 0;
+
+    if (__nconio_headless)
+    {
+        __nconio_hl_feed(buf, size);
+        __NCONIO_COUNT(writes, 1);
+        __nconio_vt_written += (unsigned long)size;
+        return;
+    }
+    __nconio_vt_written += (unsigned long)__nconio_vt_writeall(buf, size, &calls);
+    __NCONIO_COUNT(writes, calls);
+}
+
+#ifdef NCONIO_THREADS
+// Keep the output of a flush of the render thread for __nconio_writeheld. The
+// in-memory terminal takes it right away, it never blocks.
+static void __nconio_vt_hold(void)
+{
+    size_t n = __nconio_vt_outlen;
+
+    if (__nconio_vt_heldlen == 0 && __nconio_vt_held != NULL)
+    {
+        // Swap the buffers, the output goes on in the one written last time
+        char *out = __nconio_vt_held;
+        size_t cap = __nconio_vt_heldcap;
+        __nconio_vt_held = __nconio_vt_out;
+        __nconio_vt_heldcap = __nconio_vt_outcap;
+        __nconio_vt_out = out;
+        __nconio_vt_outcap = cap;
+    }
+    else
+    {
+        if (__nconio_vt_heldlen + __nconio_vt_outlen > __nconio_vt_heldcap)
+        {
+            size_t cap = __nconio_vt_heldcap ? __nconio_vt_heldcap : __NCONIO_VT_OUTSIZE;
+            while (cap < __nconio_vt_heldlen + __nconio_vt_outlen)
+            {
+                cap *= 2;
+            }
+
+            char *held = (char *)realloc(__nconio_vt_held, cap);
+            if (held == NULL)
+            {
+                // Out of memory, write it all now
+                __nconio_writeheld();
+                __nconio_vt_write(__nconio_vt_out, __nconio_vt_outlen);
+                __nconio_vt_outlen = 0;
+                return;
+            }
+            __nconio_vt_held = held;
+            __nconio_vt_heldcap = cap;
+        }
+        memcpy(__nconio_vt_held + __nconio_vt_heldlen, __nconio_vt_out, __nconio_vt_outlen);
+    }
+    __nconio_vt_heldlen += n;
+    __nconio_vt_outlen = 0;
+    __NCONIO_COUNT(writes, 1);
+    __nconio_vt_written += (unsigned long)n;
+}
+
+static void __nconio_writeheld(void)
+{
+    int calls = 0;
+
+    if (__nconio_vt_heldlen > 0)
+    {
+        __nconio_vt_writeall(__nconio_vt_held, __nconio_vt_heldlen, &calls);
+        __nconio_vt_heldlen = 0;
+    }
+}
+#endif
+
+// Write as much of the output buffer as the terminal takes without waiting
+// and keep the rest for later
+static void __nconio_vt_trywrite(void)
+{
+    size_t done = 0;
+
+    if (__nconio_headless)
+    {
+        __nconio_vt_write(__nconio_vt_out, __nconio_vt_outlen);
+        done = __nconio_vt_outlen;
+    }
+    while (done < __nconio_vt_outlen)
+    {
+        ssize_t n = write(STDOUT_FILENO, __nconio_vt_out + done, __nconio_vt_outlen - done);
+        __NCONIO_COUNT(writes, 1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                done = __nconio_vt_outlen; // The terminal is gone, nobody will read it
+            }
+            break;
+        }
+        done += (size_t)n;
+        __nconio_vt_written += (unsigned long)n;
+    }
+
+    if (done > 0)
+    {
+        memmove(__nconio_vt_out, __nconio_vt_out + done, __nconio_vt_outlen - done);
+    }
+    __nconio_vt_outlen -= done;
+    __nconio_vt_unsent = __nconio_vt_unsent > done ? __nconio_vt_unsent - done : 0;
+}
+
+// Append bytes to the output buffer
+static void __nconio_vt_emit(const char *s, size_t n)
+{
+    if (__nconio_vt_outlen + n > __nconio_vt_outcap)
+    {
+        size_t cap = __nconio_vt_outcap ? __nconio_vt_outcap : __NCONIO_VT_OUTSIZE;
+        while (cap < __nconio_vt_outlen + n)
+        {
+            cap *= 2;
+        }
+
+        char *out = (char *)realloc(__nconio_vt_out, cap);
+        if (out == NULL)
+        {
+            // Out of memory, send what we have and write the rest directly
+#ifdef NCONIO_THREADS
+            __nconio_writeheld();
+#endif
+            __nconio_vt_write(__nconio_vt_out, __nconio_vt_outlen);
+            __nconio_vt_write(s, n);
+            __nconio_vt_outlen = 0;
+            return;
+        }
+        __nconio_vt_out = out;
+        __nconio_vt_outcap = cap;
+    }
+    memcpy(__nconio_vt_out + __nconio_vt_outlen, s, n);
+    __nconio_vt_outlen += n;
+}
+
+static void __nconio_vt_emits(const char *s)
+{
+    __nconio_vt_emit(s, strlen(s));
+}
+
+// Emit a CSI sequence with up to two numeric parameters
+static void __nconio_vt_csi(int a, int b, char final)
+{
+    char seq[32];
+    int n;
+    if (b >= 0)
+    {
+        n = snprintf(seq, sizeof(seq), "\x1b[%d;%d%c", a, b, final);
+    }
+    else
+    {
+        n = snprintf(seq, sizeof(seq), "\x1b[%d%c", a, final);
+    }
+    __nconio_vt_emit(seq, (size_t)n);
+}
+
+static int __nconio_vt_digits(int n)
+{
+    int len = 1;
+    for (; n >= 10; n /= 10)
+    {
+        len++;
+    }
+    return len;
+}
+
+// Bytes of the sequence ESC [ n final, where a count of 1 is left out
+static int __nconio_vt_csilen(int n)
+{
+    return n == 1 ? 3 : 3 + __nconio_vt_digits(n);
+}
+
+static void __nconio_vt_csin(int n, char final)
+{
+    if (n == 1)
+    {
+        char seq[3] = {'\x1b', '[', final};
+        __nconio_vt_emit(seq, 3);
+        return;
+    }
+    __nconio_vt_csi(n, -1, final);
+}
+
+// Whether the cells from..to-1 of row y can be printed again to move the
+// cursor right: they show an ASCII character in the style already set
+static int __nconio_vt_canrewrite(int from, int to, int y)
+{
+    const __nconio_cell *front = __nconio_front + (size_t)y * __nconio_w;
+    for (int i = from; i < to; i++)
+    {
+        if (front[i].style != __nconio_vt_style || front[i].ch < 0x20 || front[i].ch >= 0x7f)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Cheapest way along row y from column from to column to. Returns the bytes
+// and sets *how: 'C' or 'D' (CUF, CUB), 'b' backspaces, 'r' rewriting the
+// cells in between, 'G' to go to the column directly (CHA), 0 to stay.
+static int __nconio_vt_hcost(int from, int to, int y, char *how)
+{
+    int cost = __nconio_vt_csilen(to + 1);
+    *how = 'G';
+    if (from < 0)
+    {
+        return cost; // Column unknown (pending wrap), only CHA gets there
+    }
+    if (to == from)
+    {
+        *how = 0;
+        return 0;
+    }
+    if (to > from)
+    {
+        int n = to - from;
+        if (__nconio_vt_csilen(n) < cost)
+        {
+            cost = __nconio_vt_csilen(n);
+            *how = 'C';
+        }
+        if (n < cost && __nconio_vt_canrewrite(from, to, y))
+        {
+            cost = n;
+            *how = 'r';
+        }
+    }
+    else
+    {
+        int n = from - to;
+        if (__nconio_vt_csilen(n) < cost)
+        {
+            cost = __nconio_vt_csilen(n);
+            *how = 'D';
+        }
+        if (n < cost)
+        {
+            cost = n;
+            *how = 'b';
+        }
+    }
+    return cost;
+}
+
+static void __nconio_vt_hmove(int from, int to, int y, char how)
+{
+    if (how == 'G')
+    {
+        __nconio_vt_csin(to + 1, 'G');
+    }
+    else if (how == 'C' || how == 'D')
+    {
+        __nconio_vt_csin(to > from ? to - from : from - to, how);
+    }
+    else if (how == 'b')
+    {
+        for (int i = to; i < from; i++)
+        {
+            __nconio_vt_emit("\b", 1);
+        }
+    }
+    else if (how == 'r')
+    {
+        const __nconio_cell *front = __nconio_front + (size_t)y * __nconio_w;
+        for (int i = from; i < to; i++)
+        {
+            char ch = (char)front[i].ch;
+            __nconio_vt_emit(&ch, 1);
+        }
+    }
+}
+
+// Move the terminal cursor, unless it is already there. Takes whichever is
+// shortest: an absolute position (CUP), relative moves (CUU/CUD/CUF/CUB),
+// carriage return and line feeds, backspaces, or printing the cells in
+// between again.
+static void __nconio_vt_moveto(int x, int y)
+{
+    char how, crhow = 0;
+    int vert = 0, down = 0, best, cr = -1;
+
+    if (x == __nconio_vt_x && y == __nconio_vt_y)
+    {
+        return;
+    }
+    __NCONIO_COUNT(moves, 1);
+
+    // ESC [ row ; col H, or ESC [ row H for the first column
+    best = x == 0 ? __nconio_vt_csilen(y + 1) : 4 + __nconio_vt_digits(y + 1) + __nconio_vt_digits(x + 1);
+    how = 'H';
+
+    if (__nconio_vt_y >= 0)
+    {
+        int dy = y - __nconio_vt_y;
+        vert = dy == 0 ? 0 : __nconio_vt_csilen(dy > 0 ? dy : -dy);
+
+        // Up and down keep the column, when it is known
+        if (__nconio_vt_x >= 0 || dy == 0)
+        {
+            int cost = vert + __nconio_vt_hcost(__nconio_vt_x, x, y, &crhow);
+            if (cost < best)
+            {
+                best = cost;
+                how = crhow;
+                cr = 0;
+            }
+        }
+
+        // Carriage return, then line feeds: with or without the terminal
+        // adding a CR to each LF the cursor stays in the first column
+        down = dy > 0 && dy < vert ? dy : 0;
+        int cost = 1 + (down ? down : vert) + __nconio_vt_hcost(0, x, y, &crhow);
+        if (cost < best)
+        {
+            best = cost;
+            how = crhow;
+            cr = 1;
+        }
+    }
+
+    if (how == 'H')
+    {
+        if (x == 0)
+        {
+            __nconio_vt_csin(y + 1, 'H');
+        }
+        else
+        {
+            __nconio_vt_csi(y + 1, x + 1, 'H'); // Note: VT uses 1-based row;column
+        }
+    }
+    else
+    {
+        int from = cr ? 0 : __nconio_vt_x;
+        if (cr)
+        {
+            __nconio_vt_emit("\r", 1);
+        }
+        if (cr && down)
+        {
+            for (int i = 0; i < down; i++)
+            {
+                __nconio_vt_emit("\n", 1);
+            }
+        }
+        else if (y != __nconio_vt_y)
+        {
+            __nconio_vt_csin(y > __nconio_vt_y ? y - __nconio_vt_y : __nconio_vt_y - y, y > __nconio_vt_y ? 'B' : 'A');
+        }
+        __nconio_vt_hmove(from, x, y, how);
+    }
+    __nconio_vt_x = x;
+    __nconio_vt_y = y;
+}
+
+// Switch the terminal to the style of a cell. Nothing is sent if the style is
+// already set, otherwise only the parameters that differ from the last style.
+static void __nconio_vt_setstyle(int style)
+{
+    if (style == __nconio_vt_style)
+    {
+        return;
+    }
+
+    const __nconio_styledef *to = &__nconio_styles[style];
+    const __nconio_styledef *from = __nconio_vt_style >= 0 ? &__nconio_styles[__nconio_vt_style] : NULL;
+    char seq[80] = "\x1b[";
+    size_t n = 2;
+
+    if (from == NULL || (from->attrs & ~to->attrs))
+    {
+        // An attribute has to be turned off, start from scratch
+        n += (size_t)snprintf(seq + n, sizeof(seq) - n, "0;%s%s%s;%s", to->attrsgr, to->attrs ? ";" : "", to->fgsgr, to->bgsgr);
+    }
+    else
+    {
+        if (to->attrs != from->attrs)
+        {
+            n += (size_t)snprintf(seq + n, sizeof(seq) - n, "%s;", to->attrsgr);
+        }
+        if (to->fg != from->fg)
+        {
+            n += (size_t)snprintf(seq + n, sizeof(seq) - n, "%s;", to->fgsgr);
+        }
+        if (to->bg != from->bg)
+        {
+            n += (size_t)snprintf(seq + n, sizeof(seq) - n, "%s;", to->bgsgr);
+        }
+        n--; // Drop the last ';'
+    }
+    seq[n++] = 'm';
+    __nconio_vt_emit(seq, n);
+    __NCONIO_COUNT(attrs, 1);
+    __nconio_vt_style = style;
+}
+
+// Diff the screen model and send the changed cells to the terminal
+// Control characters would move the cursor, they are drawn as blanks
+static unsigned int __nconio_vt_printable(unsigned int cp)
+{
+    return (cp < 0x20 || (cp >= 0x7f && cp < 0xa0)) ? ' ' : cp;
+}
+
+// Send a code point as UTF-8, or a byte put with the char functions as it is
+static void __nconio_vt_emitcp(unsigned int cp)
+{
+    char buf[4];
+
+    if (cp < 0x80 || __NCONIO_ISBYTE(cp))
+    {
+        buf[0] = (char)(cp < 0x80 ? cp : cp - 0xdc00);
+        __nconio_vt_emit(buf, 1);
+    }
+    else if (cp < 0x800)
+    {
+        buf[0] = (char)(0xc0 | (cp >> 6));
+        buf[1] = (char)(0x80 | (cp & 0x3f));
+        __nconio_vt_emit(buf, 2);
+    }
+    else if (cp < 0x10000)
+    {
+        buf[0] = (char)(0xe0 | (cp >> 12));
+        buf[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+        buf[2] = (char)(0x80 | (cp & 0x3f));
+        __nconio_vt_emit(buf, 3);
+    }
+    else
+    {
+        buf[0] = (char)(0xf0 | (cp >> 18));
+        buf[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+        buf[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+        buf[3] = (char)(0x80 | (cp & 0x3f));
+        __nconio_vt_emit(buf, 4);
+    }
+}
+
+// Send count cells of row where the cursor is, at column x. Runs of equal
+// cells are sent shorter where that saves bytes: blanks by erasing them (EL
+// to the end of the line, ECH otherwise), other printable characters one cell
+// wide once and then repeated (REP). Erasing keeps just the colors, so only
+// blanks without attributes are erased.
+static void __nconio_vt_emitcells(const __nconio_cell *cells, int x, int count)
+{
+    int i = 0;
+
+    while (i < count)
+    {
+        unsigned int ch = __nconio_vt_printable(__nconio_glyphcp(cells[i].ch));
+        int run = 1;
+
+        if (cells[i].ch == __NCONIO_WIDETAIL)
+        {
+            i++; // Drawn with its left half
+            continue;
+        }
+        if (i + 1 < count && cells[i + 1].ch == __NCONIO_WIDETAIL)
+        {
+            __nconio_vt_setstyle(cells[i].style);
+            __nconio_vt_emitcp(ch); // The cursor moves two columns
+            i += 2;
+            __nconio_vt_x = x + i < __nconio_w ? x + i : -1;
+            continue;
+        }
+
+        while (i + run < count && cells[i + run].style == cells[i].style && __nconio_vt_printable(__nconio_glyphcp(cells[i + run].ch)) == ch)
+        {
+            run++;
+        }
+
+        __nconio_vt_setstyle(cells[i].style);
+        int erase = ch == ' ' && __nconio_styles[cells[i].style].attrs == 0;
+        int last = i + run == count; // The cursor moves to the next span from wherever it is
+        if (erase && x + i + run == __nconio_w && run > 3)
+        {
+            __nconio_vt_emits("\x1b[K"); // Erase to the end of the line, the cursor stays
+            __nconio_vt_x = x + i;
+        }
+        else if (erase && __nconio_vt_csilen(run) * (last ? 1 : 2) < run)
+        {
+            __nconio_vt_csin(run, 'X'); // Erase characters, the cursor stays
+            if (last)
+            {
+                __nconio_vt_x = x + i;
+            }
+            else
+            {
+                __nconio_vt_csin(run, 'C');
+                __nconio_vt_x = x + i + run;
+            }
+        }
+        else
+        {
+            // REP repeats the last character printed, only well defined for a
+            // code point one cell wide. A raw byte put with the char functions
+            // may be part of a sequence the terminal decodes its own way.
+            int repeat = __nconio_vt_rep && __nconio_vt_csilen(run - 1) < run - 1 && nconio_cpwidth(ch) == 1 ? run - 1 : 0;
+            __nconio_vt_emitcp(ch);
+            if (repeat)
+            {
+                __nconio_vt_csin(repeat, 'b');
+            }
+            for (int k = 1 + repeat; k < run; k++)
+            {
+                __nconio_vt_emitcp(ch);
+            }
+
+            // Writing the last column leaves the cursor in a pending wrap state
+            __nconio_vt_x = x + i + run < __nconio_w ? x + i + run : -1;
+        }
+        i += run;
+    }
+}
+
+// FNV-1a hash of a row, step 0 hashes a row of cells all like the first
+static unsigned int __nconio_vt_rowhash(const __nconio_cell *row, int step)
+{
+    unsigned int hash = 2166136261u;
+    for (int x = 0; x < __nconio_w; x++, row += step)
+    {
+        hash = (hash ^ row->ch) * 16777619u;
+        hash = (hash ^ row->style) * 16777619u;
+    }
+    return hash;
+}
+
+// Find the rows that differ between the back and the front buffer, and the
+// first cell where they do (see __nconio_rowstart). Returns how many differ.
+static int __nconio_vt_changedrows(void)
+{
+    int changed = 0;
+
+    for (int y = 0; y < __nconio_h; y++)
+    {
+        size_t offset = (size_t)y * __nconio_w;
+        __nconio_rowstart[y] = __nconio_skipcells(__nconio_back + offset, __nconio_front + offset, 0, __nconio_w, 1);
+        changed += __nconio_rowstart[y] < __nconio_w;
+    }
+    return changed;
+}
+
+// Find the block of rows that moved furthest up or down between what the
+// terminal shows and what has been drawn, like a log or a map that scrolled.
+// Sets the rows top..bottom to scroll and by how many, positive up and
+// negative down. Returns 0 if scrolling would not save enough to be worth it.
+// Only rows that changed are hashed (see __nconio_vt_changedrows), the hashes
+// of the front rows are kept until the rows change.
+static int __nconio_vt_findscroll(int *top, int *bottom, int *n)
+{
+    int h = __nconio_h, best = 1, y0 = 0, y1 = 0, shift = 0;
+    __nconio_cell blank = {' ', 0};
+
+    if (h < 3 || __nconio_cleared)
+    {
+        return 0;
+    }
+
+    unsigned int *hb = __nconio_rowhashes, *hf = __nconio_rowhashes + h; // Hashes of the back rows, then of the front rows
+    for (int y = 0; y < h; y++)
+    {
+        if (__nconio_rowstale[y])
+        {
+            hf[y] = __nconio_vt_rowhash(__nconio_front + (size_t)y * __nconio_w, 1);
+            __nconio_rowstale[y] = 0;
+        }
+        hb[y] = __nconio_rowstart[y] < __nconio_w ? __nconio_vt_rowhash(__nconio_back + (size_t)y * __nconio_w, 1) : hf[y];
+    }
+    unsigned int blankhash = __nconio_vt_rowhash(&blank, 0);
+
+    // For every shift d, the longest run of rows where back row y is front row
+    // y + d. It fixes the rows that differ now, and costs the rows that
+    // scroll in blank but were right before.
+    for (int d = 1 - h; d < h; d++)
+    {
+        int start = -1, fixed = 0;
+        if (d == 0)
+        {
+            continue;
+        }
+        for (int y = d > 0 ? 0 : -d; y <= (d > 0 ? h - d : h); y++)
+        {
+            if (y < (d > 0 ? h - d : h) && hb[y] == hf[y + d])
+            {
+                if (start < 0)
+                {
+                    start = y;
+                    fixed = 0;
+                }
+                fixed += hb[y] != hf[y];
+                continue;
+            }
+            if (start >= 0)
+            {
+                int end = y - 1, gain = fixed;
+                int from = d > 0 ? end + 1 : start + d, to = d > 0 ? end + d : start - 1;
+                for (int i = from; i <= to; i++)
+                {
+                    gain -= hb[i] == hf[i] && hb[i] != blankhash;
+                }
+                if (gain > best)
+                {
+                    best = gain;
+                    y0 = start;
+                    y1 = end;
+                    shift = d;
+                }
+                start = -1;
+            }
+        }
+    }
+    if (shift == 0)
+    {
+        return 0;
+    }
+
+    // Hashes can collide, make sure the rows really match
+    for (int y = y0; y <= y1; y++)
+    {
+        const __nconio_cell *back = __nconio_back + (size_t)y * __nconio_w;
+        const __nconio_cell *front = __nconio_front + (size_t)(y + shift) * __nconio_w;
+        for (int x = 0; x < __nconio_w; x++)
+        {
+            if (!__nconio_celleq(&back[x], &front[x]))
+            {
+                return 0;
+            }
+        }
+    }
+
+    *top = shift > 0 ? y0 : y0 + shift;
+    *bottom = shift > 0 ? y1 + shift : y1;
+    *n = shift;
+    return 1;
+}
+
+// The terminal scrolled rows top..bottom by n (see __nconio_vt_findscroll),
+// rows came in blank in the default colors
+static void __nconio_vt_commitscroll(int top, int bottom, int n)
+{
+    __nconio_cell blank = {' ', 0};
+    size_t w = (size_t)__nconio_w;
+    int rows = bottom - top + 1 - (n > 0 ? n : -n);
+
+    unsigned int *hf = __nconio_rowhashes + __nconio_h;
+
+    if (n > 0)
+    {
+        memmove(__nconio_front + top * w, __nconio_front + (top + n) * w, (size_t)rows * w * sizeof(__nconio_cell));
+        __nconio_fillcells(__nconio_front + (bottom + 1 - n) * w, (size_t)n * w, blank);
+        memmove(hf + top, hf + top + n, (size_t)rows * sizeof(unsigned int));
+        memmove(__nconio_rowstale + top, __nconio_rowstale + top + n, (size_t)rows);
+        memset(__nconio_rowstale + bottom + 1 - n, 1, (size_t)n);
+    }
+    else
+    {
+        memmove(__nconio_front + (top - n) * w, __nconio_front + top * w, (size_t)rows * w * sizeof(__nconio_cell));
+        __nconio_fillcells(__nconio_front + top * w, (size_t)-n * w, blank);
+        memmove(hf + top - n, hf + top, (size_t)rows * sizeof(unsigned int));
+        memmove(__nconio_rowstale + top - n, __nconio_rowstale + top, (size_t)rows);
+        memset(__nconio_rowstale + top, 1, (size_t)-n);
+    }
+}
+
+#define __NCONIO_MAXSHIFT 16 // Furthest __nconio_vt_findshift looks for cells that moved sideways
+#define __NCONIO_SHIFTCOST 32 // Bytes a shift has to save, the estimates are rough
+
+// About the bytes it takes to send the cells of a row from x on that differ
+// from the front row shifted by d cells (see __nconio_vt_findshift): a cursor
+// move for each run of them, a change of style where it changes, and the cells
+static int __nconio_vt_shiftcost(const __nconio_cell *back, const __nconio_cell *front, int x, int d)
+{
+    __nconio_cell blank = {' ', 0};
+    int cost = 0, run = 0, style = -1;
+
+    for (int i = x; i < __nconio_w; i++)
+    {
+        int from = i - d; // Where the cell the terminal would show at i comes from
+        int differ = !__nconio_celleq(&back[i], from >= x && from < __nconio_w ? &front[from] : &blank);
+        if (differ)
+        {
+            cost += (run ? 1 : 6) + (back[i].style != style ? 5 : 0);
+            style = back[i].style;
+        }
+        run = differ;
+    }
+    return cost;
+}
+
+// Find how far the cells of row y moved sideways between what the terminal
+// shows and what has been drawn, like a map that panned. x is the first cell
+// that differs. Sets by how many cells to shift the row from x on, positive
+// right (blanks are inserted) and negative left (cells are deleted).
+// Returns 0 if shifting would not save enough to be worth it.
+static int __nconio_vt_findshift(int y, int x, int *n)
+{
+    const __nconio_cell *back = __nconio_back + (size_t)y * __nconio_w;
+    const __nconio_cell *front = __nconio_front + (size_t)y * __nconio_w;
+    int w = __nconio_w, cost = 0, best = -1, shift = 0;
+
+    if (front[x].ch == __NCONIO_WIDETAIL)
+    {
+        return 0;
+    }
+
+    // A row that is cheap to send as it is, like one where a sprite moved, is left to the diff
+    for (int i = x; cost <= __NCONIO_SHIFTCOST;)
+    {
+        int start = __nconio_skipcells(back, front, i, w, 1);
+        if (start >= w)
+        {
+            return 0;
+        }
+        i = __nconio_skipcells(back, front, start + 1, w, 0);
+        cost += 11 + i - start;
+    }
+
+    for (int d = -__NCONIO_MAXSHIFT; d <= __NCONIO_MAXSHIFT; d++)
+    {
+        // Cells from..to-1 end up showing what the terminal has d cells to the left
+        int from = d > 0 ? x + d : x, to = d > 0 ? w : w + d, probe;
+
+        // It must not split a wide character, where cells are cut off or deleted
+        if (d == 0 || to - from < 4 || front[d > 0 ? w - d : x - d].ch == __NCONIO_WIDETAIL)
+        {
+            continue;
+        }
+
+        // A panned row matches right away, only then is the whole row costed
+        for (probe = from; probe < from + 4 && __nconio_celleq(&back[probe], &front[probe - d]); probe++)
+        {
+        }
+        if (probe < from + 4)
+        {
+            continue;
+        }
+
+        if (best < 0)
+        {
+            best = __nconio_vt_shiftcost(back, front, x, 0) - __NCONIO_SHIFTCOST;
+        }
+        cost = __nconio_vt_shiftcost(back, front, x, d);
+        if (cost < best)
+        {
+            best = cost;
+            shift = d;
+        }
+    }
+
+    *n = shift;
+    return shift != 0;
+}
+
+// The terminal shifted row y from x on by n cells (see __nconio_vt_findshift),
+// cells came in blank in the default colors
+static void __nconio_vt_commitshift(int y, int x, int n)
+{
+    __nconio_cell blank = {' ', 0};
+    __nconio_cell *row = __nconio_front + (size_t)y * __nconio_w;
+    int w = __nconio_w;
+
+    if (n > 0)
+    {
+        memmove(row + x + n, row + x, (size_t)(w - x - n) * sizeof(__nconio_cell));
+        __nconio_fillcells(row + x, (size_t)n, blank);
+    }
+    else
+    {
+        memmove(row + x, row + x - n, (size_t)(w - x + n) * sizeof(__nconio_cell));
+        __nconio_fillcells(row + w + n, (size_t)-n, blank);
+    }
+    __nconio_rowstale[y] = 1;
+}
+
+static unsigned long __nconio_present(void)
+{
+    unsigned long written;
+    int full = 0; // The output limit was reached, the remaining spans wait for the next flush
+
+    __nconio_checkresize();
+    if (__nconio_vt_limit > 0)
+    {
+        __nconio_vt_trywrite();
+        if (__nconio_vt_unsent > 0)
+        {
+            // The terminal has not taken the last flush yet. Rather than queueing
+            // this one behind it, diff again once it has, against what it got.
+            __nconio_flush_pending = 1;
+            __NCONIO_COUNT(deferred, 1);
+            written = __nconio_vt_written;
+            __nconio_vt_written = 0;
+            return written;
+        }
+    }
+
+    if (__nconio_cleared)
+    {
+        __nconio_vt_setstyle(__nconio_clearcell.style);
+        __nconio_vt_emits("\x1b[2J");
+        __nconio_commitclear();
+    }
+
+    // Scrolling is only looked for when more than one row changed
+    int top, bottom, n;
+    if (__nconio_vt_changedrows() > 1 && __nconio_vt_findscroll(&top, &bottom, &n))
+    {
+        // Rows scroll in blank with the background set, which should be the default
+        __nconio_vt_setstyle(0);
+        if (top > 0 || bottom < __nconio_h - 1)
+        {
+            __nconio_vt_csi(top + 1, bottom + 1, 'r'); // Scroll region, moves the cursor home
+            __nconio_vt_x = -1;
+            __nconio_vt_y = -1;
+        }
+        __nconio_vt_csin(n > 0 ? n : -n, n > 0 ? 'S' : 'T');
+        if (top > 0 || bottom < __nconio_h - 1)
+        {
+            __nconio_vt_emits("\x1b[r");
+        }
+        __nconio_vt_commitscroll(top, bottom, n);
+        for (int y = top; y <= bottom; y++)
+        {
+            __nconio_rowstart[y] = 0; // Diffed again from the start
+        }
+    }
+
+    for (int y = 0; y < __nconio_h && !full; y++)
+    {
+        int x = __nconio_rowstart[y], count, shifted = 0;
+        __NCONIO_COUNT(diffed, x); // Found equal by __nconio_vt_changedrows
+        while (__nconio_nextspan(y, &x, &count))
+        {
+            const __nconio_cell *cells = __nconio_back + (size_t)y * __nconio_w + x;
+            if (__nconio_vt_limit > 0 && __nconio_vt_outlen >= __nconio_vt_limit)
+            {
+                full = 1;
+                __nconio_flush_pending = 1;
+                break;
+            }
+            if (!shifted++ && __nconio_vt_findshift(y, x, &n))
+            {
+                // Cells shift in blank with the background set, like rows scroll in
+                __nconio_vt_setstyle(0);
+                __nconio_vt_moveto(x, y);
+                __nconio_vt_csin(n > 0 ? n : -n, n > 0 ? '@' : 'P');
+                __nconio_vt_commitshift(y, x, n);
+                continue; // Diff the row again from x
+            }
+            __nconio_vt_moveto(x, y);
+            __nconio_vt_emitcells(cells, x, count);
+            __nconio_commitspan(x, y, count);
+            x += count;
+        }
+    }
+
+    if (__nconio_x < __nconio_w && __nconio_y < __nconio_h)
+    {
+        __nconio_vt_moveto(__nconio_x, __nconio_y);
+    }
+
+    if (__nconio_vt_limit > 0)
+    {
+        __nconio_vt_trywrite();
+        __nconio_vt_unsent = __nconio_vt_outlen;
+    }
+    else
+    {
+#ifdef NCONIO_THREADS
+        if (__nconio_rt_running && !__nconio_rt_active() && !__nconio_headless)
+        {
+            __nconio_vt_hold(); // The render thread writes it after releasing the state lock
+        }
+        else
+#endif
+        {
+            __nconio_vt_write(__nconio_vt_out, __nconio_vt_outlen);
+        }
+        __nconio_vt_outlen = 0;
+        __nconio_vt_unsent = 0;
+    }
+    written = __nconio_vt_written;
+    __nconio_vt_written = 0;
+    return written;
+}
+
+static int __nconio_outputfd(void)
+{
+    return __nconio_vt_outlen > 0 && __nconio_vt_limit > 0 && !__nconio_headless ? STDOUT_FILENO : -1;
+}
+
+static void __nconio_outputready(void)
+{
+    __nconio_vt_trywrite();
+    if (__nconio_vt_unsent == 0 && __nconio_flush_pending && __nconio_frame_depth == 0)
+    {
+        nconio_flush(); // What waited for the terminal, diffed against what it got
+        __nconio_completeframe();
+    }
+}
+
+void nconio_setoutputlimit(int kb)
+{
+    __nconio_rt_lock(); // Changes how the render thread writes
+    __nconio_vt_limit = kb > 0 ? (size_t)kb * 1024 : 0;
+    __nconio_rt_unlock();
+    if (__nconio_headless)
+    {
+        return; // The in-memory terminal takes everything, the limit only splits flushes
+    }
+
+    if (__nconio_vt_limit > 0 && __nconio_stdoutflags < 0)
+    {
+        int flags = fcntl(STDOUT_FILENO, F_GETFL);
+        if (flags >= 0 && fcntl(STDOUT_FILENO, F_SETFL, flags | O_NONBLOCK) == 0)
+        {
+            __nconio_stdoutflags = flags;
+        }
+    }
+    else if (__nconio_vt_limit == 0 && __nconio_stdoutflags >= 0)
+    {
+        fcntl(STDOUT_FILENO, F_SETFL, __nconio_stdoutflags);
+        __nconio_stdoutflags = -1;
+    }
+}
+
+// Take over a size change announced by SIGWINCH
+static void __nconio_checkresize(void)
+{
+    int w, h;
+
+    if (!__nconio_resized)
+    {
+        return;
+    }
+    __nconio_resized = 0;
+    __nconio_vt_getsize(&w, &h);
+    if (__nconio_resizescreen(w, h))
+    {
+        __nconio_vt_x = -1; // The terminal may have moved the cursor
+        __nconio_vt_y = -1;
+        __nconio_sizechanged = 1;
+    }
+}
+
+// Set up everything the terminal and the headless backend share
+static void __nconio_vt_start(void)
+{
+    int w, h;
+
+    __nconio_vt_getsize(&w, &h);
+    __nconio_resetstyles();
+    __nconio_resetglyphs();
+    __nconio_allocscreen(w, h);
+    __nconio_x = 0;
+    __nconio_y = 0;
+    __nconio_vt_style = -1;
+    __nconio_vt_x = -1;
+    __nconio_vt_y = -1;
+
+    __nconio_openwait();
+
+    __nconio_vt_emits("\x1b[?1049h"); // Alternate screen, cleared by the first flush
+    __nconio_flush_pending = 1;
+    nconio_flush();
+    __nconio_completeframe();
+}
+
+void nconioinit()
+{
+    nconio_resetstats();
+    __nconio_resetinput();
+    __nconio_rawmode();
+    __nconio_addleaveseq("\x1b[0m\x1b[?25h\x1b[?1049l");
+
+    // Terminals that have 24-bit colors announce it in COLORTERM
+    const char *colorterm = getenv("COLORTERM");
+    __nconio_truecolor = colorterm && (strcmp(colorterm, "truecolor") == 0 || strcmp(colorterm, "24bit") == 0);
+
+    // REP is not in every terminal (the Linux console lacks it), only use it
+    // with the ones known to have it
+    const char *term = getenv("TERM");
+    const char *reps[] = {"xterm", "tmux", "alacritty", "foot", "kitty", "wezterm", "contour"};
+    __nconio_vt_rep = 0;
+    for (size_t i = 0; term && i < sizeof(reps) / sizeof(reps[0]); i++)
+    {
+        __nconio_vt_rep |= strncmp(term, reps[i], strlen(reps[i])) == 0;
+    }
+    __nconio_vt_start();
+}
+
+void nconio_initheadless(int w, int h)
+{
+    nconio_resetstats();
+    __nconio_resetinput();
+    __nconio_hl_free();
+    __nconio_hl_x = 0;
+    __nconio_hl_y = 0;
+    __nconio_hl_wrap = 0;
+    __nconio_hl_cursor = 1;
+    __nconio_hl_seqlen = 0;
+    __nconio_hl_utf8len = 0;
+    __nconio_hl_pen.fg = -1;
+    __nconio_hl_pen.bg = -1;
+    __nconio_hl_pen.attrs = 0;
+    if (!__nconio_hl_alloc(w > 0 ? w : 80, h > 0 ? h : 25))
+    {
+        return;
+    }
+    __nconio_headless = 1;
+    __nconio_truecolor = 1; // The in-memory terminal understands every color
+    __nconio_vt_rep = 1;
+    __nconio_vt_start();
+}
+
+void nconiocleanup(void)
+{
+#ifdef NCONIO_THREADS
+    nconio_stoprender(); // Draws everything queued
+#endif
+    if (__nconio_vt_limit > 0)
+    {
+        nconio_setoutputlimit(0); // The last frame is written in full, waiting for the terminal
+        __nconio_vt_write(__nconio_vt_out, __nconio_vt_outlen);
+        __nconio_vt_outlen = 0;
+        __nconio_vt_unsent = 0;
+    }
+    nconio_flush(); // Send what is still pending
+    __nconio_vt_emits("\x1b[0m\x1b[?25h\x1b[?1049l"); // Reset colors, show cursor, main screen
+    __nconio_vt_write(__nconio_vt_out, __nconio_vt_outlen);
+    __nconio_closewait();
+    if (__nconio_headless)
+    {
+        __nconio_hl_free(); // Headless init left the terminal and signals alone
+    }
+    else
+    {
+        __nconio_cookedmode();
+    }
+
+    free(__nconio_vt_out);
+    __nconio_vt_out = NULL;
+    __nconio_vt_outlen = 0;
+    __nconio_vt_outcap = 0;
+#ifdef NCONIO_THREADS
+    free(__nconio_vt_held);
+    __nconio_vt_held = NULL;
+    __nconio_vt_heldcap = 0;
+#endif
+    __nconio_freesurfaces();
+    __nconio_freescreen();
+    __nconio_freestyles();
+}
+
+void hidecursor()
+{
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_HIDECURSOR, 0, 0, 0, 0, NULL, 0);
+        return;
+    }
+    __nconio_vt_emits("\x1b[?25l"); // Make the cursor invisible
+    __nconio_touch();
+}
+
+void showcursor()
+{
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_SHOWCURSOR, 0, 0, 0, 0, NULL, 0);
+        return;
+    }
+    __nconio_vt_emits("\x1b[?25h"); // Make the cursor visible
+    __nconio_touch();
+}
+
+#else
+// ------------------------------------------------------------------
+//    Linux: ncurses backend
+// ------------------------------------------------------------------
+#define NCURSES_WIDECHAR 1 // add_wch, link with -lncursesw
+#include <ncurses.h>
+#include <locale.h>
+#include <wchar.h>
+
+// Color pairs are allocated the first time a combination of colors is drawn.
+// When the terminal runs out of pairs, the least recently used one is recycled.
+static short *__nconio_pairfg = NULL;          // Curses colors of each pair, indexed by pair number
+static short *__nconio_pairbg = NULL;
+static unsigned long *__nconio_pairused = NULL; // When each pair was last used
+static unsigned long __nconio_pairclock = 0;
+static int __nconio_paircount = 0; // Pairs 1 to __nconio_paircount are in use
+static int __nconio_pairmax = 0;   // Pairs the terminal has, without pair 0
+static int *__nconio_stylepair = NULL; // Pair last used for each style, 0 if none
+static int __nconio_stylepaircap = 0;
+static int __nconio_recycled = 0; // A pair that is on screen was recycled during this flush
+
+// Curses color number for any color, the nearest one if the terminal has fewer colors
+static short __nconio_cursescolor(int color)
+{
+    int r, g, b;
+    if (color <= NCONIO_WHITE)
+    {
+        int ansi = __nconio_ansi[color & 7];
+        return (short)(color >= 8 && COLORS >= 16 ? ansi + 8 : ansi);
+    }
+    if ((color & ~0xff) == 0x100 && COLORS >= 256)
+    {
+        return (short)(color & 0xff);
+    }
+
+    __nconio_colorrgb(color, &r, &g, &b);
+    if (COLORS >= 256)
+    {
+        return (short)__nconio_nearest256(r, g, b);
+    }
+    return __nconio_cursescolor(__nconio_nearest16(r, g, b));
+}
+
+// Cells on screen drawn with a recycled pair changed color, draw them again
+static void __nconio_repaintpair(int pair)
+{
+    for (size_t i = 0; i < (size_t)__nconio_w * __nconio_h; i++)
+    {
+        int style = __nconio_front[i].style;
+        if (style < __nconio_stylepaircap && __nconio_stylepair[style] == pair)
+        {
+            // Make the front cell differ from the back cell, so the next diff picks it up
+            __nconio_front[i].ch = (unsigned short)(__nconio_back[i].ch ^ 1);
+            __nconio_recycled = 1;
+        }
+    }
+}
+
+// Get the pair for a style, allocating or recycling one if needed
+static int __nconio_stylepairof(int style)
+{
+    const __nconio_styledef *def = &__nconio_styles[style];
+    short fg = __nconio_cursescolor(def->fg);
+    short bg = __nconio_cursescolor(def->bg);
+    int pair;
+
+    if (style >= __nconio_stylepaircap)
+    {
+        int cap = __nconio_stylepaircap ? __nconio_stylepaircap : 64;
+        while (cap <= style)
+        {
+            cap *= 2;
+        }
+        int *stylepair = (int *)realloc(__nconio_stylepair, (size_t)cap * sizeof(int));
+        if (stylepair == NULL)
+        {
+            return 0;
+        }
+        memset(stylepair + __nconio_stylepaircap, 0, (size_t)(cap - __nconio_stylepaircap) * sizeof(int));
+        __nconio_stylepair = stylepair;
+        __nconio_stylepaircap = cap;
+    }
+
+    // Still the pair this style had last time?
+    pair = __nconio_stylepair[style];
+    if (pair == 0 || __nconio_pairfg[pair] != fg || __nconio_pairbg[pair] != bg)
+    {
+        // Another style with the same colors may already have a pair
+        for (pair = 1; pair <= __nconio_paircount; pair++)
+        {
+            if (__nconio_pairfg[pair] == fg && __nconio_pairbg[pair] == bg)
+            {
+                break;
+            }
+        }
+
+        if (pair > __nconio_paircount)
+        {
+            if (__nconio_paircount < __nconio_pairmax)
+            {
+                pair = ++__nconio_paircount;
+            }
+            else
+            {
+                // Recycle the least recently used pair
+                pair = 1;
+                for (int i = 2; i <= __nconio_paircount; i++)
+                {
+                    if (__nconio_pairused[i] < __nconio_pairused[pair])
+                    {
+                        pair = i;
+                    }
+                }
+                __nconio_repaintpair(pair);
+            }
+            init_pair((short)pair, fg, bg);
+            __nconio_pairfg[pair] = fg;
+            __nconio_pairbg[pair] = bg;
+        }
+        __nconio_stylepair[style] = pair;
+    }
+
+    __nconio_pairused[pair] = ++__nconio_pairclock;
+    return pair;
+}
+
+// ncurses attributes for a style, without the color pair
+static attr_t __nconio_curses_attr(int style)
+{
+    const __nconio_styledef *def = &__nconio_styles[style];
+    attr_t attr = A_NORMAL;
+    if ((def->attrs & NCONIO_BOLD) || (def->fg >= 8 && def->fg <= NCONIO_WHITE && COLORS < 16))
+    {
+        attr |= A_BOLD; // Without 16 colors bright colors are shown as bold
+    }
+    if (def->attrs & NCONIO_UNDERLINE)
+    {
+        attr |= A_UNDERLINE;
+    }
+    if (def->attrs & NCONIO_REVERSE)
+    {
+        attr |= A_REVERSE;
+    }
+    return attr;
+}
+
+// Draw a code point at the cursor. ncurses moves the cursor past both halves
+// of a wide character, the right half is not drawn on its own.
+static void __nconio_curses_addcp(unsigned int cp)
+{
+    if (cp == __NCONIO_WIDETAIL)
+    {
+        return;
+    }
+    if (cp < 0x80 || __NCONIO_ISBYTE(cp))
+    {
+        addch((unsigned char)(cp < 0x80 ? cp : cp - 0xdc00));
+        return;
+    }
+
+    cchar_t cc;
+    attr_t attr;
+    short pair;
+    wchar_t wc[2] = {(wchar_t)cp, 0};
+    attr_get(&attr, &pair, NULL);
+    setcchar(&cc, wc, attr, pair, NULL);
+    add_wch(&cc);
+}
+
+// Hand all changed cells to ncurses. Returns 0 if a pair had to be recycled
+// that is still on screen, then the affected cells need another pass.
+static int __nconio_drawspans(void)
+{
+    int style = -1;
+
+    __nconio_recycled = 0;
+    for (int y = 0; y < __nconio_h; y++)
+    {
+        int x = 0, count;
+        while (__nconio_nextspan(y, &x, &count))
+        {
+            const __nconio_cell *cells = __nconio_back + (size_t)y * __nconio_w + x;
+            move(y, x); // Note: ncurses uses y, x instead of x, y
+            __NCONIO_COUNT(moves, 1);
+            for (int i = 0; i < count; i++)
+            {
+                if (cells[i].style != style)
+                {
+                    style = cells[i].style;
+                    attr_set(__nconio_curses_attr(style), (short)__nconio_stylepairof(style), NULL);
+                    __NCONIO_COUNT(attrs, 1);
+                }
+                __nconio_curses_addcp(__nconio_glyphcp(cells[i].ch));
+            }
+            __nconio_commitspan(x, y, count);
+            x += count;
+        }
+    }
+    return !__nconio_recycled;
+}
+
+// Diff the screen model and hand the changed cells to ncurses
+static unsigned long __nconio_present(void)
+{
+    __nconio_checkresize();
+    if (__nconio_cleared)
+    {
+        int pair = __nconio_stylepairof(__nconio_clearcell.style);
+        // Old style chtype attributes only hold pairs up to 255
+        bkgdset(' ' | (pair <= 255 ? COLOR_PAIR(pair) : 0));
+        clear();
+        __nconio_commitclear();
+        if (pair > 255)
+        {
+            // The screen was cleared with the default pair, draw all blanks again
+            for (size_t i = 0; i < (size_t)__nconio_w * __nconio_h; i++)
+            {
+                __nconio_front[i].ch = (unsigned short)(__nconio_back[i].ch ^ 1);
+            }
+        }
+    }
+
+    // A second pass draws cells whose pair was recycled in the first one
+    if (!__nconio_drawspans())
+    {
+        __nconio_drawspans();
+    }
+
+    move(__nconio_y, __nconio_x);
+    refresh();
+    return 0; // ncurses does not tell how much it wrote
+}
+
+// ncurses writes the whole refresh itself, there is no output left to wait for
+static int __nconio_outputfd(void)
+{
+    return -1;
+}
+
+static void __nconio_outputready(void)
+{
+}
+
+void nconio_setoutputlimit(int kb)
+{
+    (void)kb;
+}
+
+#ifdef NCONIO_THREADS
+static void __nconio_writeheld(void)
+{
+    // ncurses writes to the terminal inside refresh, there is nothing to hold
+}
+#endif
+
+void nconioinit()
+{
+    nconio_resetstats();
+    __nconio_resetinput();
+    __nconio_rawmode(); // Before initscr, so endwin comes back to it and we restore the rest
+    if (strcmp(setlocale(LC_CTYPE, NULL), "C") == 0)
+    {
+        setlocale(LC_CTYPE, ""); // ncurses writes UTF-8 only in a UTF-8 locale
+    }
+    initscr(); // Start curses mode
+    cbreak();           // Line buffering disabled
+    noecho();           // Don't echo typed keys
+
+    // What endwin would send, for the fatal signal handler
+    const char *caps[] = {"sgr0", "cnorm", "rmcup"};
+    for (int i = 0; i < 3; ++i)
+    {
+        const char *seq = tigetstr(caps[i]);
+        __nconio_addleaveseq(seq == (char *)-1 ? NULL : seq);
+    }
+
+    // init colors
+    if (has_colors() == FALSE)
+    {
+        endwin();
+        __nconio_cookedmode();
+        printf("Your terminal does not support color\n");
+        exit(1);
+    }
+
+    start_color();
+    // Color pairs are created when they are first drawn, pair numbers must fit in a short
+    __nconio_pairmax = COLOR_PAIRS - 1 < 32767 ? COLOR_PAIRS - 1 : 32767;
+    __nconio_paircount = 0;
+    __nconio_pairclock = 0;
+    __nconio_pairfg = (short *)calloc((size_t)__nconio_pairmax + 1, sizeof(short));
+    __nconio_pairbg = (short *)calloc((size_t)__nconio_pairmax + 1, sizeof(short));
+    __nconio_pairused = (unsigned long *)calloc((size_t)__nconio_pairmax + 1, sizeof(unsigned long));
 
-        // Apply only the background bits, preserving the foreground
-        __nconio_currentAttributes = (__nconio_currentAttributes & 0xFF0F) | winColor;
+    __nconio_resetstyles();
+    __nconio_resetglyphs();
+    __nconio_allocscreen(COLS, LINES);
+    __nconio_x = 0;
+    __nconio_y = 0;
+    __nconio_openwait();
+}
 
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-        SetConsoleTextAttribute(hConsole, __nconio_currentAttributes);
-    }
+void nconiocleanup(void)
+{
+#ifdef NCONIO_THREADS
+    nconio_stoprender(); // Draws everything queued
+#endif
+    showcursor();            // Show cursor on exit
+    nconio_flush();          // Send what is still pending
+    endwin();       // Clean up ncurses environment before exiting
+    __nconio_closewait();
+    __nconio_cookedmode();
+    __nconio_freesurfaces();
+    __nconio_freescreen();
+    __nconio_freestyles();
+    free(__nconio_pairfg);
+    free(__nconio_pairbg);
+    free(__nconio_pairused);
+    free(__nconio_stylepair);
+    __nconio_pairfg = NULL;
+    __nconio_pairbg = NULL;
+    __nconio_pairused = NULL;
+    __nconio_stylepair = NULL;
+    __nconio_stylepaircap = 0;
+}
 
-    void textcolorreset()
+// Take over a size change announced by SIGWINCH
+static void __nconio_checkresize(void)
+{
+    int w, h;
+
+    if (!__nconio_resized)
     {
-        textcolor(-1);
+        return;
+    }
+    __nconio_resized = 0;
+    __nconio_termsize(&w, &h);
+    if (w != COLS || h != LINES)
+    {
+        resizeterm(h, w);
     }
+    if (__nconio_resizescreen(w, h))
+    {
+        __nconio_sizechanged = 1;
+    }
+}
 
-    void textbackgroundreset()
+void hidecursor()
+{
+    if (__nconio_rt_active())
     {
-        textbackground(-1);
+        __nconio_rt_push(__NCONIO_RT_HIDECURSOR, 0, 0, 0, 0, NULL, 0);
+        return;
     }
+    curs_set(0); // Make the cursor invisible
+}
 
-    int conw(void)
+void showcursor()
+{
+    if (__nconio_rt_active())
     {
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        int width;
+        __nconio_rt_push(__NCONIO_RT_SHOWCURSOR, 0, 0, 0, 0, NULL, 0);
+        return;
+    }
+    curs_set(1); // Make the cursor visible
+}
 
-        // Get the handle to the standard output device (the console)
-        HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+#endif // NCONIO_VT
 
-        // Get the console screen buffer info
-        if (!GetConsoleScreenBufferInfo(hStdout, &csbi))
+// ------------------------------------------------------------------
+//    Linux: shared by both backends
+// ------------------------------------------------------------------
+
+// Wait until input arrives, meanwhile writing output a slow terminal did not
+// take yet. Returns 1 if there is input to read, 0 on timeout.
+static int __nconio_waitinput(int timeout_ms)
+{
+    long long deadline = timeout_ms > 0 ? __nconio_now() + (long long)timeout_ms * 1000 : 0;
+
+    for (;;)
+    {
+        // Polled even for a blocking wait: on a terminal stdin and stdout usually
+        // share their file status flags, so a non-blocking stdout makes read() return at once
+        struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {__nconio_rt_active() ? -1 : __nconio_outputfd(), POLLOUT, 0}};
+        int timeout = timeout_ms;
+        if (timeout_ms > 0)
         {
-            // Return a default value if the function call fails
-            width = 80; // Default width
+            long long left = deadline - __nconio_now();
+            timeout = left > 0 ? (int)((left + 999) / 1000) : 0;
         }
-        else
+
+        int n = poll(fds, 2, timeout);
+        if (n < 0 && errno == EINTR)
         {
-            // Calculate the width
-            width = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+            continue;
+        }
+        if (n <= 0)
+        {
+            return 0;
+        }
+        if (fds[1].revents & POLLOUT)
+        {
+            __nconio_outputready();
+        }
+        if (fds[0].revents)
+        {
+            return 1; // Also on hangup, read() reports the end of input
         }
-
-        return width;
     }
+}
 
-    int conh(void)
-    {
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        int height;
+// Read all input that is waiting with a single read() and decode it into key events
+static int __nconio_pollinput(int timeout_ms)
+{
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    int before = __nconio_keycount;
 
-        // Get the handle to the standard output device (the console)
-        HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+#ifdef NCONIO_VT
+    if (__nconio_headless)
+    {
+        return __nconio_keycount > 0 ? 0 : -1; // Only nconio_headless_input queues keys
+    }
+#endif
 
-        // Get the console screen buffer info
-        if (!GetConsoleScreenBufferInfo(hStdout, &csbi))
+    if (__nconio_waitinput(timeout_ms))
+    {
+        ssize_t n = read(STDIN_FILENO, __nconio_inbuf + __nconio_inlen, sizeof(__nconio_inbuf) - __nconio_inlen);
+        if (n > 0)
         {
-            // Return a default value if the function call fails
-            height = 25; // Default height
+            __nconio_inlen += (int)n;
+            __nconio_decodeinput(__nconio_inlen == (int)sizeof(__nconio_inbuf));
         }
-        else
+        else if (n == 0)
         {
-            // Calculate the height
-            height = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+            return -1; // End of input
         }
-
-        return height;
     }
 
-    char getchat(int x, int y)
+    // Half an escape sequence: the rest follows right away, or it was the Escape key
+    while (__nconio_inlen > 0)
     {
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-        TCHAR ch;
-        DWORD read;
-        COORD coord = {(SHORT)x, (SHORT)y};
-
-        if (ReadConsoleOutputCharacter(hConsole, &ch, 1, coord, &read))
+        if (poll(&pfd, 1, 25) > 0)
         {
-            return ch;
+            ssize_t n = read(STDIN_FILENO, __nconio_inbuf + __nconio_inlen, sizeof(__nconio_inbuf) - __nconio_inlen);
+            if (n > 0)
+            {
+                __nconio_inlen += (int)n;
+                __nconio_decodeinput(__nconio_inlen == (int)sizeof(__nconio_inbuf));
+                continue;
+            }
         }
-        return '\0';
+        __nconio_decodeinput(1);
     }
 
-    int consizechanged(void)
-    {
-        static int prev_height = 0, prev_width = 0; // Previous dimensions
+    return __nconio_keycount > before;
+}
 
-        HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
+int nconio_wait(int timeout_ms)
+{
+    int events = 0;
+    long long deadline = timeout_ms > 0 ? __nconio_now() + (long long)timeout_ms * 1000 : 0;
 
-        if (GetConsoleScreenBufferInfo(hStdout, &csbi))
+    __nconio_syncinput();
+    for (;;)
+    {
+        struct pollfd fds[4] = {{STDIN_FILENO, POLLIN, 0}, {__nconio_wakefd[0], POLLIN, 0}, {-1, POLLIN, 0},
+                                {__nconio_rt_active() ? -1 : __nconio_outputfd(), POLLOUT, 0}};
+        int timeout = __nconio_keycount > 0 ? 0 : timeout_ms;
+        if (timeout > 0)
         {
-            int currentWidth = csbi.srWindow.Right - csbi.srWindow.Left + 1;
-            int currentHeight = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+            long long left = deadline - __nconio_now();
+            timeout = left > 0 ? (int)((left + 999) / 1000) : 0;
+        }
+#ifdef NCONIO_VT
+        if (__nconio_headless)
+        {
+            fds[0].fd = -1; // Input comes from nconio_headless_input only
+        }
+#endif
+#if defined(__linux__)
+        fds[2].fd = __nconio_timerfd;
+#else
+        if (__nconio_timerms > 0)
+        {
+            long long left = __nconio_timerdue - __nconio_now();
+            int ms = left > 0 ? (int)((left + 999) / 1000) : 0;
+            timeout = timeout < 0 || ms < timeout ? ms : timeout;
+        }
+#endif
 
-            if (currentWidth != prev_width || currentHeight != prev_height)
+        if (poll(fds, 4, timeout) < 0)
+        {
+            continue; // Interrupted, most likely by SIGWINCH which the next poll sees
+        }
+
+        if (fds[3].revents & POLLOUT)
+        {
+            __nconio_outputready();
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            char buf[64];
+            while (read(__nconio_wakefd[0], buf, sizeof(buf)) > 0)
             {
-                // Update last known dimensions
-                prev_width = currentWidth;
-                prev_height = currentHeight;
-                return 1; // True: Size has changed
             }
+            events |= NCONIO_EVENT_RESIZE;
+            __nconio_rt_lock();
+            __nconio_checkresize();
+            __nconio_flush_pending = 1; // What came into view is painted with the next flush
+            __nconio_rt_unlock();
+        }
+#if defined(__linux__)
+        if (fds[2].revents & POLLIN)
+        {
+            unsigned long long ticks;
+            if (read(__nconio_timerfd, &ticks, sizeof(ticks)) == (ssize_t)sizeof(ticks))
+            {
+                events |= NCONIO_EVENT_TIMER;
+            }
+        }
+#else
+        if (__nconio_timerms > 0 && __nconio_now() >= __nconio_timerdue)
+        {
+            // Ticks that were missed are dropped, not made up for
+            long long now = __nconio_now();
+            while (__nconio_timerdue <= now)
+            {
+                __nconio_timerdue += (long long)__nconio_timerms * 1000;
+            }
+            events |= NCONIO_EVENT_TIMER;
+        }
+#endif
+        if (fds[0].revents & POLLIN)
+        {
+            __nconio_pollinput(0);
+        }
+        if (__nconio_keycount > 0)
+        {
+            events |= NCONIO_EVENT_KEY;
         }
-        return 0; // False: Size has not changed
-    }
 
-    void hidecursor()
-    {
-        HANDLE consoleHandle = GetStdHandle(STD_OUTPUT_HANDLE);
-        CONSOLE_CURSOR_INFO info;
-        info.dwSize = 100;     // The size of the cursor, from 1 to 100. The default size is 25.
-        info.bVisible = FALSE; // Hide the cursor
-        SetConsoleCursorInfo(consoleHandle, &info);
+        // Input that was no key (e.g. an unknown escape sequence) only ends a wait with a timeout
+        if (events || timeout_ms == 0 || (timeout_ms > 0 && __nconio_now() >= deadline) || (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL)))
+        {
+            return events;
+        }
     }
+}
 
-    void showcursor()
+// Returns whether the size of the console window has changed since
+// the last call to consizechanged
+int consizechanged(void)
+{
+    int changed;
+
+    __nconio_rt_lock();
+    __nconio_checkresize();
+    changed = __nconio_sizechanged;
+    if (changed)
     {
-        HANDLE consoleHandle = GetStdHandle(STD_OUTPUT_HANDLE);
-        CONSOLE_CURSOR_INFO info;
-        info.dwSize = 100;    // The size of the cursor, from 1 to 100. The default size is 25.
-        info.bVisible = TRUE; // Hide the cursor
-        SetConsoleCursorInfo(consoleHandle, &info);
+        __nconio_sizechanged = 0;
+        __nconio_flush_pending = 1; // What came into view is painted with the next flush
     }
+    __nconio_rt_unlock();
+    return changed;
+}
 
-#elif defined(__linux__) || (defined(__APPLE__) && defined(__MACH__))
-// ##################################################################
-//    Linux
-// ##################################################################
-#include <ncurses.h>
-#include <stdlib.h>
-#include <termios.h>
-#include <unistd.h>
-#include <stdio.h>
-#include <signal.h>
-
-// Global variables to store current foreground and background colors
-static int __nconio_current_fg = NCONIO_WHITE; // Default to white on black
-static int __nconio_current_bg = NCONIO_BLACK;
-
-void nconioinit()
+void nconio_settimer(int interval_ms)
 {
-    initscr();               // Start curses mode
-    cbreak();                // Line buffering disabled
-    noecho();                // Don't echo while we do getch
-    nodelay(stdscr, TRUE);   // Make getch non-blocking
-    keypad(stdscr, TRUE);    // Enable function and arrow keys
-    signal(SIGINT, SIG_IGN); // Ignore Ctrl-C
+#if defined(__linux__)
+    struct itimerspec spec;
 
-    // init colors
-    if (has_colors() == FALSE)
+    if (__nconio_timerfd < 0)
     {
-        endwin();
-        printf("Your terminal does not support color\n");
-        exit(1);
+        if (interval_ms <= 0)
+        {
+            return;
+        }
+        __nconio_timerfd = timerfd_create(__NCONIO_CLOCK, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (__nconio_timerfd < 0)
+        {
+            return;
+        }
+    }
+    memset(&spec, 0, sizeof(spec)); // All zero stops the timer
+    if (interval_ms > 0)
+    {
+        spec.it_interval.tv_sec = interval_ms / 1000;
+        spec.it_interval.tv_nsec = (long)(interval_ms % 1000) * 1000000;
+        spec.it_value = spec.it_interval;
     }
+    timerfd_settime(__nconio_timerfd, 0, &spec, NULL);
+#else
+    __nconio_timerms = interval_ms > 0 ? interval_ms : 0;
+    __nconio_timerdue = __nconio_now() + (long long)__nconio_timerms * 1000;
+#endif
+}
 
-    start_color();
-    // Initialize color pairs
-    for (int fg = 0; fg < 8; fg++)
+int putchr(int ch)
+{
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_PUTCHR, ch, 0, 0, 0, NULL, 0);
+        return ch;
+    }
+    if (ch == '\n')
+    {
+        __nconio_x = 0;
+        if (__nconio_y < __nconio_h - 1)
+        {
+            __nconio_y++;
+        }
+    }
+    else
     {
-        for (int bg = 0; bg < 8; bg++)
+        __nconio_setcell(__nconio_x, __nconio_y, (char)ch);
+        // Wrap at the end of the line like a terminal does
+        if (++__nconio_x >= __nconio_w)
         {
-            // Calculate a unique pair number based on fg and bg
-            // Assumes COLOR_BLACK to COLOR_WHITE are 0 to 7
-            int pair_number = fg * 8 + bg + 1;
-            init_pair(pair_number, fg, bg);
+            __nconio_x = 0;
+            if (__nconio_y < __nconio_h - 1)
+            {
+                __nconio_y++;
+            }
         }
     }
+    __nconio_touch(); // Refresh the screen unless a frame is being collected
+    return ch;
 }
 
-void nconiocleanup(void)
+// Composited surface cells and Unicode text go into the back buffer and are diffed like any other drawing
+static void __nconio_putcells(const __nconio_cell *cells, int count, int x, int y)
 {
-    endwin();                // Clean up ncurses environment before exiting
-    showcursor();            // Show cursor on exit
-    textcolorreset();        // Reset the text color
-    textbackgroundreset();   // reset the background color
-    signal(SIGINT, SIG_DFL); // Restore default Ctrl-C behavior
+    memmove(&__nconio_back[y * __nconio_w + x], cells, (size_t)count * sizeof(__nconio_cell));
 }
 
-int kbhit(void)
+// Draw a row on the target surface, or the screen if there is none
+static void __nconio_drawrow(const char *chars, const unsigned char *attrs, int count, int x, int y)
 {
-    int ch = getch();
-
-    if (ch != ERR)
+    if (!__nconio_surfacedraw(chars, attrs, count, x, y))
     {
-        // For ASCII characters, ch contains the keycode
-        return ch; // Return the ASCII keycode
+        __nconio_blitrow(chars, attrs, count, x, y);
     }
-    else
+}
+
+void putchat(char ch, int x, int y)
+{
+    if (__nconio_rt_active())
     {
-        return 0; // No key pressed
+        __nconio_rt_push(__NCONIO_RT_PUTCHAT, ch, x, y, 0, NULL, 0);
+        return;
     }
+    __nconio_drawrow(&ch, NULL, 1, x, y);
+    __nconio_touch(); // Apply changes unless a frame is being collected
 }
 
-int getchr(void)
+void putstrat(const char *str, int x, int y)
 {
-    struct termios oldt, newt;
-    int ch;
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-    newt.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-    ch = getchar();
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-    return ch;
+    if (__nconio_rt_active())
+    {
+        putrow(str, NULL, (int)strlen(str), x, y);
+        return;
+    }
+    __nconio_drawrow(str, NULL, (int)strlen(str), x, y);
+    __nconio_touch();
 }
 
-void putchr(int ch)
+void putrow(const char *chars, const unsigned char *attrs, int count, int x, int y)
 {
-    addch(ch);
-    refresh(); // Refresh the screen to show the output
+    if (__nconio_rt_active())
+    {
+        char *data = count > 0 ? __nconio_rt_begin(__NCONIO_RT_PUTROW, count, x, y, attrs != NULL, attrs ? 2 * count : count) : NULL;
+        if (data)
+        {
+            memcpy(data, chars, (size_t)count);
+            if (attrs)
+            {
+                memcpy(data + count, attrs, (size_t)count);
+            }
+            __nconio_rt_end();
+        }
+        return;
+    }
+    __nconio_drawrow(chars, attrs, count, x, y);
+    __nconio_touch();
 }
 
-void putchat(char ch, int x, int y)
+void putrect(const char *chars, const unsigned char *attrs, int w, int h, int stride, int x, int y)
 {
-    mvaddch(y, x, ch); // Move to (y,x) and add a character
-    refresh();         // Apply changes to the actual screen
+    if (__nconio_rt_active())
+    {
+        // Queued row by row, the frame keeps it one flush
+        nconio_beginframe();
+        for (int row = 0; row < h; row++)
+        {
+            putrow(chars + (size_t)row * stride, attrs ? attrs + (size_t)row * stride : NULL, w, x, y + row);
+        }
+        nconio_endframe();
+        return;
+    }
+    for (int row = 0; row < h; row++)
+    {
+        __nconio_drawrow(chars + (size_t)row * stride, attrs ? attrs + (size_t)row * stride : NULL, w, x, y + row);
+    }
+    __nconio_touch(); // One flush for the whole block
 }
 
 void gotoxy(int x, int y)
 {
-    move(y, x); // Note: ncurses uses y, x instead of x, y
-    refresh();  // Refresh the screen to apply the cursor move
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_GOTOXY, x, y, 0, 0, NULL, 0);
+        return;
+    }
+    if (x < 0 || y < 0 || x >= __nconio_w || y >= __nconio_h)
+    {
+        return;
+    }
+    __nconio_x = x;
+    __nconio_y = y;
+    __nconio_touch(); // Apply the cursor move unless a frame is being collected
 }
 
 void clrscr(void)
 {
-    clear();   // Clears the screen in ncurses
-    refresh(); // Refreshes the screen to apply changes
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_CLRSCR, 0, 0, 0, 0, NULL, 0);
+        return;
+    }
+    if (__nconio_target)
+    {
+        __nconio_clearsurface();
+        __nconio_touch();
+        return;
+    }
+    __nconio_clearscreen();
+    __nconio_x = 0;
+    __nconio_y = 0;
+    __nconio_touch(); // Apply changes unless a frame is being collected
 }
 
 void textcolor(int color)
 {
-    __nconio_current_fg = color; // Update the global foreground color
-    // Calculate the pair number based on current foreground and background
-    int pair_number = __nconio_current_fg * 8 + __nconio_current_bg + 1;
-    attron(COLOR_PAIR(pair_number));
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_TEXTCOLOR, color, 0, 0, 0, NULL, 0);
+        return;
+    }
+    if (!__nconio_validcolor(color))
+    {
+        color = NCONIO_WHITE;
+    }
+    // Used by all cells drawn from now on
+    __nconio_setcolors(color, __nconio_styles[__nconio_style].bg);
 }
 
 void textcolorreset()
@@ -666,10 +7172,17 @@ void textcolorreset()
 
 void textbackground(int color)
 {
-    __nconio_current_bg = color;
-    // Calculate the pair number based on current foreground and background
-    int pair_number = __nconio_current_fg * 8 + __nconio_current_bg + 1;
-    attron(COLOR_PAIR(pair_number));
+    if (__nconio_rt_active())
+    {
+        __nconio_rt_push(__NCONIO_RT_TEXTBACKGROUND, color, 0, 0, 0, NULL, 0);
+        return;
+    }
+    if (!__nconio_validcolor(color))
+    {
+        color = NCONIO_BLACK;
+    }
+    // Used by all cells drawn from now on
+    __nconio_setcolors(__nconio_styles[__nconio_style].fg, color);
 }
 
 void textbackgroundreset()
@@ -677,79 +7190,44 @@ void textbackgroundreset()
     textbackground(NCONIO_BLACK);
 }
 
+// With a render thread these report the calls it has applied so far
+
 // Get current cursor X position
 int wherex(void)
 {
-    int x, y;
-    // getyx is a macro, so we don't use & for variables
-    getyx(stdscr, y, x);
+    __nconio_rt_lock();
+    int x = __nconio_x;
+    __nconio_rt_unlock();
     return x;
 }
 
 // Get current cursor Y position
 int wherey(void)
 {
-    int x, y;
-    // getyx is a macro, so we don't use & for variables
-    getyx(stdscr, y, x);
+    __nconio_rt_lock();
+    int y = __nconio_y;
+    __nconio_rt_unlock();
     return y;
 }
 
 // Get the width in characters of the console
 int conw(void)
 {
-    int height, width;
-    getmaxyx(stdscr, height, width); // Use stdscr for the standard screen
-    return width;
+    __nconio_rt_lock();
+    int w = __nconio_w;
+    __nconio_rt_unlock();
+    return w;
 }
 
 // Get the height in characters of the console
 int conh(void)
 {
-    int height, width;
-    getmaxyx(stdscr, height, width);
-    return height;
-}
-
-char getchat(int x, int y)
-{
-    // Move to position and get the character
-    chtype ch = mvinch(y, x); // Note: ncurses uses y,x instead of x,y
-    return ch & A_CHARTEXT;   // Mask out the character portion
-}
-
-// Returns whether the size of the console window has changed since
-// the last call to consizechanged
-int consizechanged(void)
-{
-    static int prev_height = 0, prev_width = 0; // Previous dimensions
-    int height, width;
-
-    // Get current dimensions
-    getmaxyx(stdscr, height, width);
-
-    // Check if the dimensions have changed
-    if (width != prev_width || height != prev_height)
-    {
-        // Update stored dimensions to current for the next call
-        prev_width = width;
-        prev_height = height;
-        return 1; // True, size has changed
-    }
-
-    // No change in size
-    return 0;
-}
-
-void hidecursor()
-{
-    curs_set(0); // Make the cursor invisible
+    __nconio_rt_lock();
+    int h = __nconio_h;
+    __nconio_rt_unlock();
+    return h;
 }
 
-void showcursor()
-{
-    curs_set(1); // Make the cursor invisible
-}
 
 #elif defined(__APPLE__) && defined(__MACH__)
 // ##################################################################